@@ -0,0 +1,35 @@
+#version 330 core
+out vec4 FragColor;
+
+// One iteration of an edge-stopping a-trous wavelet filter over the
+// indirect irradiance, in the lower left `viewport` texels of each target
+uniform sampler2D source;
+uniform sampler2D normalDepth;
+uniform vec2 viewport;
+uniform int stepSize;
+// depth difference, relative to the center depth, that halves a weight
+uniform float depthSigma;
+uniform float normalPower;
+
+void main()
+{
+    const float kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+    ivec2 size = ivec2(viewport);
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 center = texelFetch(normalDepth, pixel, 0);
+
+    vec3 sum = vec3(0.0);
+    float weights = 0.0;
+    for (int y = -2; y <= 2; ++y) {
+        for (int x = -2; x <= 2; ++x) {
+            ivec2 tap = clamp(pixel + ivec2(x, y) * stepSize, ivec2(0), size - 1);
+            vec4 guide = texelFetch(normalDepth, tap, 0);
+            float w = kernel[abs(x)] * kernel[abs(y)];
+            w *= pow(max(dot(center.xyz, guide.xyz), 0.0), normalPower);
+            w *= exp2(-abs(center.w - guide.w) / (depthSigma * center.w + 1e-4));
+            sum += texelFetch(source, tap, 0).rgb * w;
+            weights += w;
+        }
+    }
+    FragColor = vec4(sum / max(weights, 1e-6), 1.0);
+}
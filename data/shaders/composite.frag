@@ -0,0 +1,16 @@
+#version 330 core
+out vec4 FragColor;
+
+// Recombines the split lighting of the camera pass after denoising
+uniform sampler2D source; // linear direct light
+uniform sampler2D indirectLight;
+uniform sampler2D albedo;
+uniform float indirectLightPower;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec3 direct = texelFetch(source, pixel, 0).rgb;
+    vec3 indirect = clamp(texelFetch(indirectLight, pixel, 0).rgb * texelFetch(albedo, pixel, 0).rgb, 0.0, 1.0);
+    FragColor = vec4(pow(direct + indirect * indirectLightPower, vec3(1.0 / 2.2)), 1.0);
+}
@@ -0,0 +1,36 @@
+#version 330 core
+out vec4 FragColor;
+
+// Recombines interleaved sampling: any blockSize x blockSize window holds
+// every sample subset once. Neighbours on other surfaces are rejected by the
+// depth and normal guide, the rest are weighted by their sample count.
+uniform sampler2D source;
+uniform sampler2D normalDepth;
+uniform vec2 viewport;
+uniform int blockSize;
+uniform float depthSigma;
+uniform float normalPower;
+
+void main()
+{
+    ivec2 size = ivec2(viewport);
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 center = texelFetch(normalDepth, pixel, 0);
+    int first = -(blockSize / 2);
+
+    vec3 sum = vec3(0.0);
+    float weights = 0.0;
+    for (int y = first; y < first + blockSize; ++y) {
+        for (int x = first; x < first + blockSize; ++x) {
+            ivec2 tap = clamp(pixel + ivec2(x, y), ivec2(0), size - 1);
+            vec4 guide = texelFetch(normalDepth, tap, 0);
+            vec4 light = texelFetch(source, tap, 0);
+            float w = light.a;
+            w *= pow(max(dot(center.xyz, guide.xyz), 0.0), normalPower);
+            w *= exp2(-abs(center.w - guide.w) / (depthSigma * center.w + 1e-4));
+            sum += light.rgb * w;
+            weights += w;
+        }
+    }
+    FragColor = vec4(sum / max(weights, 1e-6), 1.0);
+}
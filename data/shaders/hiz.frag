@@ -0,0 +1,21 @@
+#version 330 core
+out float FragColor;
+
+// One level of the max depth pyramid. Each texel takes the farthest of the
+// 3x3 source texels starting at twice its position, which also covers the
+// extra row and column of odd sized levels.
+uniform sampler2D source; // scene depth or the previous level
+uniform vec2 sourceSize;
+
+void main()
+{
+    ivec2 last = ivec2(sourceSize) - 1;
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    float depth = 0.0;
+    for (int y = 0; y < 3; ++y) {
+        for (int x = 0; x < 3; ++x) {
+            depth = max(depth, texelFetch(source, min(base + ivec2(x, y), last), 0).r);
+        }
+    }
+    FragColor = depth;
+}
@@ -3,17 +3,34 @@
 layout (location = 0) out vec3 Flux;
 layout (location = 1) out vec3 Normal;
 
-uniform bool use_base_color;
-uniform sampler2D base_color;
-uniform vec4 base_color_factor;
-uniform float far_plane;
-uniform vec3 lightPos;
-uniform vec3 lightColor;
+// two RGBA32F texels per material, keep in sync with Gltf::MaterialData
+struct Material {
+    vec4 baseColorFactor;
+    vec4 baseColor; // layer, has texture
+};
+uniform samplerBuffer materials;
+
+Material fetchMaterial(uint index)
+{
+    int texel = int(index) * 2;
+    return Material(texelFetch(materials, texel), texelFetch(materials, texel + 1));
+}
+uniform sampler2DArray baseColorPage;
+// per shadow pass, keep in sync with ShadowData in rsm/main.cpp
+layout (std140) uniform Shadow {
+    mat4 shadowMatrices[6];
+    vec3 lightPos;
+    float far_plane;
+    vec3 lightColor;
+    // bit i set if cube face i is rendered
+    int faceMask;
+};
 
 in GS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    flat uint Material;
 } fs_in;
 
 vec3 shade(vec3 lightIntensity, vec3 lightDir, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess) {
@@ -30,7 +47,8 @@ void main()
     Normal = (fs_in.Normal + vec3(1.0)) / 2.0;
 
     vec3 directLighting = vec3(0, 0, 0);
-    vec3 color = use_base_color ? texture(base_color, fs_in.TexCoords).rgb : base_color_factor.rgb;
+    Material material = fetchMaterial(fs_in.Material);
+    vec3 color = material.baseColor.y != 0 ? texture(baseColorPage, vec3(fs_in.TexCoords, material.baseColor.x)).rgb : material.baseColorFactor.rgb;
     vec3 normal = normalize(fs_in.Normal);
     vec3 lightDir = normalize(lightPos - fs_in.FragPos);
     float lightDist = length(lightPos - fs_in.FragPos);
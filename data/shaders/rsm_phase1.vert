@@ -2,19 +2,32 @@
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 3) in vec2 texCoords;
+layout (location = 6) in uint material;
 
-uniform mat4 model;
+// Gltf::InstanceData of all instances, seven texels each
+uniform samplerBuffer instances;
+uniform int firstInstance;
 
 out VS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    flat uint Material;
 } vs_out;
 
 void main()
 {
+    int instance = (firstInstance + gl_InstanceID) * 7;
+    mat4 model = mat4(texelFetch(instances, instance),
+                      texelFetch(instances, instance + 1),
+                      texelFetch(instances, instance + 2),
+                      texelFetch(instances, instance + 3));
+    mat3 normalMatrix = mat3(texelFetch(instances, instance + 4).xyz,
+                             texelFetch(instances, instance + 5).xyz,
+                             texelFetch(instances, instance + 6).xyz);
     gl_Position = model * vec4(position, 1.0);
     vs_out.FragPos = vec3(model * vec4(position, 1.0));
-    vs_out.Normal = transpose(inverse(mat3(model))) * normal;
+    vs_out.Normal = normalMatrix * normal;
     vs_out.TexCoords = texCoords;
+    vs_out.Material = material;
 }
\ No newline at end of file
@@ -1,33 +1,81 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+// Written when the lighting is split for the denoiser. FragColor then holds
+// the linear direct light and IndirectLight the irradiance without albedo,
+// with the number of samples it averages in alpha.
+layout (location = 1) out vec4 IndirectLight;
+layout (location = 2) out vec4 Albedo;
+layout (location = 3) out vec4 NormalDepth;
 
 in VS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    flat uint Material;
 } fs_in;
 
-uniform bool use_base_color;
-uniform sampler2D base_color;
-uniform vec4 base_color_factor;
+// two RGBA32F texels per material, keep in sync with Gltf::MaterialData
+struct Material {
+    vec4 baseColorFactor;
+    vec4 baseColor; // layer, has texture
+};
+uniform samplerBuffer materials;
 
-uniform sampler2D randomMap;
+Material fetchMaterial(uint index)
+{
+    int texel = int(index) * 2;
+    return Material(texelFetch(materials, texel), texelFetch(materials, texel + 1));
+}
+uniform sampler2DArray baseColorPage;
+
+// points in [0, 1)^2 from SampleSet, rotated by sampleOffset every frame
+uniform samplerBuffer samplePattern;
 uniform samplerCube depthMap;
 uniform samplerCube fluxMap;
 uniform samplerCube normalMap;
 
-uniform vec3 lightPos;
-uniform vec3 lightColor;
-uniform vec3 viewPos;
-
-uniform bool disableDirectLight;
-uniform bool disableIndirectLight;
-uniform float indirectLightPower;
-uniform float directLightPower;
-uniform float sampleRange;
-uniform int sampleNum;
+// per camera pass, keep in sync with FrameData in rsm/main.cpp
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 lightPos;
+    float far_plane;
+    vec3 lightColor;
+    float sampleRange;
+    vec3 viewPos;
+    int sampleNum;
+    // rotates the sample pattern every frame
+    vec2 sampleOffset;
+    // Each pixel of an interleave x interleave block evaluates a disjoint
+    // subset of the samples, the gather pass recombines the block
+    int interleave;
+    float indirectLightPower;
+    float directLightPower;
+    bool disableDirectLight;
+    bool disableIndirectLight;
+    bool splitLighting;
+};
 
-uniform float far_plane;
+// Specialized permutations define these as compile-time constants, the
+// generic program falls back to the uniforms.
+#ifndef DIRECT_LIGHT
+#define DIRECT_LIGHT (!disableDirectLight)
+#endif
+#ifndef INDIRECT_LIGHT
+#define INDIRECT_LIGHT (!disableIndirectLight)
+#endif
+#ifndef SPLIT_LIGHTING
+#define SPLIT_LIGHTING splitLighting
+#endif
+// SAMPLE_NUM_MAX only bounds the gather loop, a pixel still stops at its
+// share of sampleNum unless SAMPLE_NUM_EXACT says that every pixel takes
+// exactly SAMPLE_NUM_MAX samples.
+#ifndef SAMPLE_NUM_MAX
+#define SAMPLE_NUM_MAX sampleNum
+#endif
+#ifndef SAMPLE_NUM_EXACT
+#define SAMPLE_NUM_EXACT false
+#endif
 
 float calcShadow(vec3 fragPos)
 {
@@ -47,38 +95,60 @@ vec3 shade(vec3 lightIntensity, vec3 lightDir, vec3 normal, vec3 viewDir, vec3 d
     return diffuse + specular;
 }
 
-vec3 randomBiasVec(vec3 vec, float sinTheta, vec2 randomVec) {
+vec3 randomBiasVec(vec3 vec, float sinTheta, vec2 diskOffset) {
     vec3 vert1 = vec3(0), vert2 = vec3(0);
     vert1 = vec3(vec.y, -vec.x, 0) + vec3(vec.z, 0, -vec.x) + vec3(0, vec.z, -vec.y);
     vert1 = normalize(vert1);
     vert2 = cross(vec, vert1);
 
-    randomVec = randomVec * 2 - vec2(1.0);
-    return normalize(vec + sinTheta * (randomVec.x * vert1 + randomVec.y * vert2));
+    return normalize(vec + sinTheta * (diskOffset.x * vert1 + diskOffset.y * vert2));
 }
 
 void main()
 {
     // 1. direct lighting
     vec3 directLighting = vec3(0, 0, 0);
-    vec3 color = use_base_color ? texture(base_color, fs_in.TexCoords).rgb : base_color_factor.rgb;
+    Material material = fetchMaterial(fs_in.Material);
+    vec3 color = material.baseColor.y != 0 ? texture(baseColorPage, vec3(fs_in.TexCoords, material.baseColor.x)).rgb : material.baseColorFactor.rgb;
     vec3 normal = normalize(fs_in.Normal);
-    vec3 lightDir = normalize(lightPos - fs_in.FragPos);
     vec3 viewDir = normalize(viewPos - fs_in.FragPos);
-    float lightDist = length(lightPos - fs_in.FragPos);
-    float attenuation = 0.6 / (lightDist * lightDist);
-    vec3 directLightIntensity = lightColor * attenuation;
-    directLighting = shade(directLightIntensity, lightDir, normal, viewDir, color, color, 64.0);
-    float shadow = calcShadow(fs_in.FragPos);
-    directLighting *= 1.0 - shadow;
-    directLighting *= vec3(!disableDirectLight);
+    if (DIRECT_LIGHT) {
+        vec3 lightDir = normalize(lightPos - fs_in.FragPos);
+        float lightDist = length(lightPos - fs_in.FragPos);
+        float attenuation = 0.6 / (lightDist * lightDist);
+        vec3 directLightIntensity = lightColor * attenuation;
+        directLighting = shade(directLightIntensity, lightDir, normal, viewDir, color, color, 64.0);
+        float shadow = calcShadow(fs_in.FragPos);
+        directLighting *= 1.0 - shadow;
+    }
 
-    // 2. indirect lighting
+    // 2. indirect lighting, gathered with a white albedo so that the denoiser
+    // does not blur texture detail
     vec3 indirectLighting = vec3(0, 0, 0);
     vec3 coord = normalize(fs_in.FragPos - lightPos);
-    for (int i = 0; i < sampleNum; ++i) {
-        vec3 r = texelFetch(randomMap, ivec2(i, 0), 0).xyz;
-        vec3 sampleCoord = randomBiasVec(coord, sampleRange, r.xy);
+    // each pixel of the interleave block takes its own aligned power of two
+    // range of the sequence, which is well distributed by itself. Strided
+    // subsets are not, for Sobol and Halton the low index bits pick the
+    // radius. Keep in sync with sampleSetSize() in rsm/main.cpp.
+    ivec2 cell = ivec2(gl_FragCoord.xy) % interleave;
+    int pixel = cell.y * interleave + cell.x;
+    int blockSize = interleave * interleave;
+    int pixelSamples = sampleNum / blockSize + (pixel < sampleNum % blockSize ? 1 : 0);
+    int perPixel = (sampleNum + blockSize - 1) / blockSize;
+    int pixelRange = 1;
+    while (pixelRange < perPixel) pixelRange *= 2;
+    int firstSample = pixel * pixelRange;
+    int sampleCount = 0;
+    for (int j = 0; INDIRECT_LIGHT && j < SAMPLE_NUM_MAX; ++j) {
+        if (!SAMPLE_NUM_EXACT && j >= pixelSamples) break;
+        int i = firstSample + j;
+        sampleCount++;
+        // polar mapping to the unit disk, denser towards the center, so the
+        // samples are weighted by their squared radius
+        vec2 u = fract(texelFetch(samplePattern, i).xy + sampleOffset);
+        float angle = u.y * 2.0 * 3.14159265;
+        float weight = u.x * u.x;
+        vec3 sampleCoord = randomBiasVec(coord, sampleRange, u.x * vec2(sin(angle), cos(angle)));
         float patchDepth = texture(depthMap, sampleCoord).x * far_plane;
         vec3 patchPosition = lightPos + patchDepth * sampleCoord;
         vec3 patchFlux = texture(fluxMap, sampleCoord).xyz;
@@ -86,12 +156,20 @@ void main()
         vec3 deltaPos = fs_in.FragPos - patchPosition;
         vec3 indirectLightDir = -normalize(deltaPos);
         vec3 indirectLightIntensity = clamp(patchFlux * max(0, dot(patchNormal, deltaPos)) * max(0, dot(normal, -deltaPos)) / pow(dot(deltaPos, deltaPos) , 2.0), vec3(0), patchFlux);
-        indirectLighting += r.z * shade(indirectLightIntensity, indirectLightDir, normal, viewDir, color, color, 64.0);
+        indirectLighting += weight * shade(indirectLightIntensity, indirectLightDir, normal, viewDir, vec3(1.0), vec3(1.0), 64.0);
+    }
+    indirectLighting /= max(sampleCount, 1);
+
+    if (SPLIT_LIGHTING) {
+        FragColor = vec4(directLighting * directLightPower, 1.0);
+        IndirectLight = vec4(indirectLighting, sampleCount);
+        Albedo = vec4(color, 1.0);
+        NormalDepth = vec4(normal, length(viewPos - fs_in.FragPos));
+        return;
     }
-    indirectLighting = clamp(indirectLighting / sampleNum, 0.0, 1.0);
-    indirectLighting *= vec3(!disableIndirectLight);
 
     // 3. sum up
+    indirectLighting = clamp(indirectLighting * color, 0.0, 1.0);
     FragColor = vec4(directLighting * directLightPower + indirectLighting * indirectLightPower, 1.0);
     FragColor.rgb = pow(FragColor.rgb, vec3(1.0/2.2));
 }
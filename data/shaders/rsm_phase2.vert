@@ -2,6 +2,7 @@
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 3) in vec2 texCoords;
+layout (location = 6) in uint material;
 
 out vec2 TexCoords;
 
@@ -9,16 +10,52 @@ out VS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    flat uint Material;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+// per camera pass, keep in sync with FrameData in rsm/main.cpp
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 lightPos;
+    float far_plane;
+    vec3 lightColor;
+    float sampleRange;
+    vec3 viewPos;
+    int sampleNum;
+    // rotates the sample pattern every frame
+    vec2 sampleOffset;
+    // Each pixel of an interleave x interleave block evaluates a disjoint
+    // subset of the samples, the gather pass recombines the block
+    int interleave;
+    float indirectLightPower;
+    float directLightPower;
+    bool disableDirectLight;
+    bool disableIndirectLight;
+    bool splitLighting;
+};
+// Gltf::InstanceData of all instances, seven texels each
+uniform samplerBuffer instances;
+uniform int firstInstance;
+// with culling, the instances that passed the test are listed from
+// firstInstance on
+uniform usamplerBuffer visibleInstances;
+uniform bool culled;
 
 void main()
 {
+    int index = firstInstance + gl_InstanceID;
+    int instance = (culled ? int(texelFetch(visibleInstances, index).r) : index) * 7;
+    mat4 model = mat4(texelFetch(instances, instance),
+                      texelFetch(instances, instance + 1),
+                      texelFetch(instances, instance + 2),
+                      texelFetch(instances, instance + 3));
+    mat3 normalMatrix = mat3(texelFetch(instances, instance + 4).xyz,
+                             texelFetch(instances, instance + 5).xyz,
+                             texelFetch(instances, instance + 6).xyz);
     gl_Position = projection * view * model * vec4(position, 1.0f);
     vs_out.FragPos = vec3(model * vec4(position, 1.0));
-    vs_out.Normal = transpose(inverse(mat3(model))) * normal;
+    vs_out.Normal = normalMatrix * normal;
     vs_out.TexCoords = texCoords;
+    vs_out.Material = material;
 }
\ No newline at end of file
@@ -0,0 +1,34 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the scene covers the lower left `viewport` texels of `source`
+uniform sampler2D source;
+uniform vec2 viewport;
+uniform float sharpness;
+
+vec3 fetch(vec2 uv, vec2 texel)
+{
+    // never filter in texels outside the rendered region
+    return texture(source, clamp(uv, 0.5 * texel, (viewport - 0.5) * texel)).rgb;
+}
+
+void main()
+{
+    vec2 texel = 1.0 / vec2(textureSize(source, 0));
+    vec2 uv = TexCoords * viewport * texel;
+
+    vec3 c = fetch(uv, texel);
+    vec3 n = fetch(uv + vec2(0.0, texel.y), texel);
+    vec3 s = fetch(uv - vec2(0.0, texel.y), texel);
+    vec3 e = fetch(uv + vec2(texel.x, 0.0), texel);
+    vec3 w = fetch(uv - vec2(texel.x, 0.0), texel);
+
+    // unsharp mask against the cross neighbours, clamped to their range so
+    // that edges do not ring
+    vec3 lo = min(c, min(min(n, s), min(e, w)));
+    vec3 hi = max(c, max(max(n, s), max(e, w)));
+    vec3 sharpened = c + sharpness * (c - 0.25 * (n + s + e + w));
+    FragColor = vec4(clamp(sharpened, lo, hi), 1.0);
+}
@@ -0,0 +1,125 @@
+// Measures the scheduling overhead of JobSystem and how parallel_for scales
+// with the number of workers.
+//
+//   jobs_bench [max_workers]
+#include "../common/jobs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double elapsed_ms(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // best of a few runs, the first one also warms up the workers
+    template<typename F>
+    double best_ms(int runs, F && f) {
+        double best = 1e30;
+        for (int i = 0; i < runs; i++) {
+            auto start = Clock::now();
+            f();
+            best = std::min(best, elapsed_ms(start));
+        }
+        return best;
+    }
+
+    // enough arithmetic per item that the loop is not bound by memory
+    float kernel(size_t i) {
+        float x = (float) i * 0.001f;
+        for (int k = 0; k < 16; k++) {
+            x = std::sin(x) * 0.5f + std::sqrt(x + 1.0f);
+        }
+        return x;
+    }
+
+    void overhead(JobSystem & jobs) {
+        const size_t COUNT = 100000;
+
+        auto submit_ms = best_ms(3, [&] {
+            std::vector<JobSystem::Handle> handles;
+            handles.reserve(COUNT);
+            for (size_t i = 0; i < COUNT; i++) {
+                handles.push_back(jobs.submit([] {}));
+            }
+            for (auto & handle : handles) {
+                jobs.wait(handle);
+            }
+        });
+        std::printf("empty jobs:        %8.1f ns per job\n", submit_ms * 1e6 / COUNT);
+
+        // every job waits for the previous one, nothing runs in parallel
+        const size_t CHAIN = 10000;
+        auto         chain_ms = best_ms(3, [&] {
+            JobSystem::Handle last;
+            for (size_t i = 0; i < CHAIN; i++) {
+                last = jobs.submit([] {}, { last });
+            }
+            jobs.wait(last);
+        });
+        std::printf("dependency chain:  %8.1f ns per job\n", chain_ms * 1e6 / CHAIN);
+
+        // many small jobs spawned by one job, joined by another
+        auto fan_ms = best_ms(3, [&] {
+            std::vector<JobSystem::Handle> children;
+            auto root = jobs.submit([&] {
+                for (size_t i = 0; i < COUNT; i++) {
+                    children.push_back(jobs.submit([] {}));
+                }
+            });
+            jobs.wait(root);
+            auto join = jobs.submit([] {}, children);
+            jobs.wait(join);
+        });
+        std::printf("fan out and join:  %8.1f ns per job\n", fan_ms * 1e6 / COUNT);
+
+        const size_t ITEMS = 1 << 16;
+        auto         empty_for_ms = best_ms(10, [&] {
+            jobs.parallel_for(0, ITEMS, 64, [](size_t, size_t) {});
+        });
+        std::printf("empty parallel_for: %7.1f us per call, %zu chunks\n", empty_for_ms * 1e3, ITEMS / 64);
+    }
+} // namespace
+
+int main(int argc, char ** argv) {
+    unsigned hardware    = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned max_workers = argc > 1 ? (unsigned) std::stoul(argv[1]) : hardware - 1;
+    max_workers          = std::max(max_workers, 1u);
+    std::printf("%u hardware threads\n\n", hardware);
+
+    {
+        JobSystem jobs(max_workers);
+        std::printf("overhead with %u workers\n", jobs.worker_count());
+        overhead(jobs);
+        auto stats = jobs.stats();
+        std::printf("executed %llu jobs, %llu stolen\n\n", (unsigned long long) stats.executed, (unsigned long long) stats.stolen);
+    }
+
+    const size_t       ITEMS = 1 << 20;
+    std::vector<float> out(ITEMS);
+    auto               serial_ms = best_ms(3, [&] {
+        for (size_t i = 0; i < ITEMS; i++) out[i] = kernel(i);
+    });
+    std::printf("parallel_for scaling, %zu items\n", ITEMS);
+    std::printf("%8s %8s %10s %8s\n", "threads", "grain", "ms", "speedup");
+    std::printf("%8u %8s %10.2f %8.2f\n", 1u, "-", serial_ms, 1.0);
+    for (unsigned workers = 1; workers <= max_workers; workers = workers < max_workers ? std::min(workers * 2, max_workers) : workers + 1) {
+        JobSystem jobs(workers);
+        for (size_t grain : { (size_t) 1024, (size_t) 16384 }) {
+            auto ms = best_ms(5, [&] {
+                jobs.parallel_for(0, ITEMS, grain, [&](size_t first, size_t last) {
+                    for (size_t i = first; i < last; i++) out[i] = kernel(i);
+                });
+            });
+            // the calling thread works on the loop as well
+            std::printf("%8u %8zu %10.2f %8.2f\n", workers + 1, grain, ms, serial_ms / ms);
+        }
+    }
+    return 0;
+}
@@ -1,6 +1,12 @@
 #include "application.hpp"
+#include "capture.hpp"
 #include "data.hpp"
+#include "frame_pacing.hpp"
+#include "shader.hpp"
+#include "timing.hpp"
 #include "utils.hpp"
+#include <charconv>
+#include <cstdint>
 #include <ctime>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -10,7 +16,6 @@
 #include <imgui/imgui_impl_opengl3.h>
 #include <iostream>
 #include <sstream>
-#include <stb_image_write.h>
 #include <stdexcept>
 
 // Include order of headers here is important
@@ -33,6 +38,7 @@ GLFWwindow *
 #ifdef __APPLE__ // for macos
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
+    glfwWindowHint(GLFW_VISIBLE, _options.hidden ? GLFW_FALSE : GLFW_TRUE);
     GLFWwindow * window = glfwCreateWindow(width, height, name, nullptr, nullptr);
     if (! window) {
         throw std::runtime_error("failed to create window");
@@ -68,8 +74,62 @@ GLFWwindow *
     return window;
 }
 
-Application::Application(const char * name, int width, int height):
-    _frame_time_samples(30) {
+const char * LaunchOptions::usage() {
+    return "usage: [--hidden] [--profile-frames N] [--profile-output FILE.csv] [--frames-in-flight N] [--low-latency] [--set NAME=VALUE]...";
+}
+
+LaunchOptions LaunchOptions::parse(int argc, char ** argv) {
+    const char * usage = LaunchOptions::usage();
+    LaunchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg  = argv[i];
+        auto        next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("missing value for " + arg + "\n" + usage);
+            }
+            return argv[++i];
+        };
+        // the whole value as a decimal integer in [min, max]
+        auto number = [&](uint32_t min, uint32_t max) {
+            auto     value  = next();
+            uint32_t result = 0;
+            auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+            if (error != std::errc() || end != value.data() + value.size() || result < min || result > max) {
+                throw std::runtime_error("invalid value for " + arg + "\n" + usage);
+            }
+            return result;
+        };
+        if (arg == "--hidden") {
+            options.hidden = true;
+        } else if (arg == "--profile-frames") {
+            options.profile_frames = number(1, UINT32_MAX);
+        } else if (arg == "--profile-output") {
+            options.profile_output = next();
+        } else if (arg == "--frames-in-flight") {
+            options.frames_in_flight = number(1, FramePacer::MAX_FRAMES_IN_FLIGHT);
+        } else if (arg == "--low-latency") {
+            options.low_latency = true;
+        } else if (arg == "--set") {
+            auto value = next();
+            auto equal = value.find('=');
+            if (equal == std::string::npos) {
+                throw std::runtime_error("expected NAME=VALUE after --set\n" + std::string(usage));
+            }
+            options.settings[value.substr(0, equal)] = value.substr(equal + 1);
+        } else {
+            throw std::runtime_error("unknown argument " + arg + "\n" + usage);
+        }
+    }
+    return options;
+}
+
+std::string LaunchOptions::setting(const std::string & name, const std::string & fallback) const {
+    auto it = settings.find(name);
+    return it == settings.end() ? fallback : it->second;
+}
+
+Application::Application(const char * name, int width, int height, const LaunchOptions & options):
+    _options(options), _frame_time_samples(30) {
     _window = create_window(name, width, height);
     _width  = width;
     _height = height;
@@ -81,12 +141,39 @@ Application::Application(const char * name, int width, int height):
     assert(glGetError() == 0);
     MicroProfileInitUI();
 
+    _capture = std::make_unique<FrameCapture>();
+    _timings = std::make_unique<FrameTimings>();
+    _pacer   = std::make_unique<FramePacer>(_options.frames_in_flight, _options.low_latency);
+
+    if (! ShaderCompiler::driver_compiles_in_parallel()) {
+        // never shown, its context shares objects with the main one
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        _compiler_window = glfwCreateWindow(1, 1, name, nullptr, _window);
+        if (_compiler_window != nullptr) {
+            auto * window = _compiler_window;
+            _compiler     = std::make_unique<ShaderCompiler>([window] { glfwMakeContextCurrent(window); }, [] { glfwMakeContextCurrent(nullptr); });
+        } else {
+            std::cout << "warn: no shared context, shaders compile on the render thread" << std::endl;
+        }
+    }
+
     auto p              = MicroProfileGet();
     p->nDisplay         = MP_DRAW_DETAILED;
     p->nAllGroupsWanted = 1;
+    if (_options.profile_frames > 0) {
+        MicroProfileSetAggregateFrames((int) _options.profile_frames);
+    }
 }
 
 Application::~Application() {
+    _compiler.reset();
+    if (_compiler_window != nullptr) {
+        glfwDestroyWindow(_compiler_window);
+    }
+    // pending readbacks still need the GL context
+    _capture.reset();
+    _pacer.reset();
+    _timings.reset();
     MicroProfileShutdown();
     ImGui::DestroyContext();
     glfwDestroyWindow(_window);
@@ -108,10 +195,14 @@ void Application::run() {
 
     _t = glfwGetTime();
     while (! glfwWindowShouldClose(_window)) {
+        // before sampling input and time, so both are as fresh as the
+        // queue allows
+        _pacer->begin_frame();
         float t_now = glfwGetTime();
         _delta      = t_now - _t;
         _t     = t_now;
         _frame_time_samples.push(Clock::now());
+        _timings->begin_frame();
         glfwPollEvents();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -122,23 +213,32 @@ void Application::run() {
             update();
         }
 
+        int fb_width, fb_height;
+        glfwGetFramebufferSize(_window, &fb_width, &fb_height);
         if (_need_screen_shot) {
             screen_shot();
             _need_screen_shot = false;
         }
+        _capture->on_frame(fb_width, fb_height);
 
         if (should_draw_profiler_ui()) {
             draw_profiler_ui();
         }
 
         MicroProfileFlip();
-        int fb_width, fb_height;
-        glfwGetFramebufferSize(_window, &fb_width, &fb_height);
-        ImGui::Render();
-        glViewport(0, 0, fb_width, fb_height);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        update_profile_dump();
+        {
+            auto scope = _timings->scope("UI");
+            ImGui::Render();
+            glViewport(0, 0, fb_width, fb_height);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
 
-        glfwSwapBuffers(_window);
+        {
+            auto scope = _timings->scope("Swap", false);
+            glfwSwapBuffers(_window);
+        }
+        _pacer->end_frame();
     }
 }
 
@@ -205,17 +305,42 @@ void Application::request_screen_shot() {
 void Application::screen_shot() {
     int width, height;
     glfwGetFramebufferSize(_window, &width, &height);
-    std::vector<uint8_t> data;
-    glFlush();
-    glReadBuffer(GL_BACK);
-    data.resize(width * height * 4);
-    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+    _capture->capture(width, height, fs::absolute(get_screen_shot_filename()));
+}
+
+FrameCapture & Application::frame_capture() {
+    return *_capture;
+}
 
-    auto output_path = fs::absolute(get_screen_shot_filename()).string();
+FramePacer & Application::frame_pacer() {
+    return *_pacer;
+}
 
-    stbi_flip_vertically_on_write(true);
-    stbi_write_png(output_path.c_str(), width, height, 4, data.data(), 0);
-    std::cout << "screen shot written to " << output_path << std::endl;
+FrameTimings & Application::frame_timings() {
+    return *_timings;
+}
+
+ShaderCompiler * Application::shader_compiler() {
+    return _compiler.get();
+}
+
+void Application::update_profile_dump() {
+    if (_options.profile_frames == 0) {
+        return;
+    }
+    // the first aggregate window warms up caches and shader builds, the
+    // second one is dumped by the flip following the request
+    _frame_count++;
+    if (_frame_count == 2 * _options.profile_frames) {
+        MicroProfileDumpFile(_options.profile_output.c_str(), MicroProfileDumpTypeCsv, _options.profile_frames);
+    } else if (_frame_count == 2 * _options.profile_frames + 1) {
+        fs::path output = fs::absolute(_options.profile_output);
+        fs::path frames = output.parent_path() / (output.stem().string() + "-frames.csv");
+        _timings->export_csv(frames);
+        std::cout << "profile of " << _options.profile_frames << " frames written to " << output.string()
+                  << ", frame timings to " << frames.string() << std::endl;
+        glfwSetWindowShouldClose(_window, GLFW_TRUE);
+    }
 }
 
 void Application::toggle_profiler_ui() {
@@ -243,6 +368,10 @@ float Application::getAspect() const {
     return _aspect;
 }
 
+const LaunchOptions & Application::launch_options() const {
+    return _options;
+}
+
 void Application::draw_profiler_ui() const {
     // frame buffer size and window logical size will be different on high DPI
     // display
@@ -3,19 +3,52 @@
 #include "utils.hpp"
 #include <chrono>
 #include <glm/glm.hpp>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 struct GLFWwindow;
+class FrameCapture;
+class FramePacer;
+class FrameTimings;
+class ShaderCompiler;
+
+// Command line switches shared by all demos
+struct LaunchOptions {
+  bool hidden = false;
+  // dump a MicroProfile capture of this many frames, then exit
+  uint32_t profile_frames = 0;
+  std::string profile_output = "ogl-profile.csv";
+  // frames the CPU may queue ahead of the GPU, 1 with low_latency
+  uint32_t frames_in_flight = 2;
+  bool low_latency = false;
+  // demo specific values, given as --set name=value
+  std::map<std::string, std::string> settings;
+
+  static LaunchOptions parse(int argc, char **argv);
+  static const char *usage();
+  std::string setting(const std::string &name,
+                      const std::string &fallback) const;
+};
 
 class Application {
 public:
-  Application(const char *name, int width, int height);
+  Application(const char *name,
+              int width,
+              int height,
+              const LaunchOptions &options = {});
   virtual ~Application();
 
   void run();
   float average_frame_time();
   void request_screen_shot();
   void toggle_profiler_ui();
+  FrameCapture &frame_capture();
+  FramePacer &frame_pacer();
+  FrameTimings &frame_timings();
+  // nullptr if the driver compiles shaders in parallel by itself
+  ShaderCompiler *shader_compiler();
 
 protected:
   float getDelta() const;
@@ -23,6 +56,7 @@ protected:
   int getWidth() const;
   int getHeight() const;
   float getAspect() const;
+  const LaunchOptions &launch_options() const;
   virtual void init() {}
   virtual void update() {}
   virtual void key_callback(int key, int scancode, int action, int mods) {}
@@ -40,6 +74,7 @@ private:
   void draw_profiler_ui() const;
 
   GLFWwindow *create_window(const char *name, int width, int height);
+  void update_profile_dump();
 
   static void window_key_callback(
       GLFWwindow *window, int key, int scancode, int action, int mods);
@@ -65,6 +100,13 @@ private:
 
   void screen_shot();
 
+  LaunchOptions _options;
+  uint64_t _frame_count = 0;
+  std::unique_ptr<FrameCapture> _capture;
+  std::unique_ptr<FramePacer> _pacer;
+  GLFWwindow *_compiler_window{};
+  std::unique_ptr<ShaderCompiler> _compiler;
+  std::unique_ptr<FrameTimings> _timings;
   bool _need_screen_shot = false;
   bool _display_profiler = false;
   int _width, _height;
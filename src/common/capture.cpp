@@ -0,0 +1,221 @@
+#include "capture.hpp"
+#include "profile.h"
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stb_image_write.h>
+
+FrameCapture::FrameCapture(uint32_t ring_size, uint32_t encoder_count):
+    _ring(ring_size), _max_queued_encodes(2 * (size_t) encoder_count) {
+    // the back buffer is bottom-up, the images are top-down
+    stbi_flip_vertically_on_write(true);
+    for (auto & slot : _ring) {
+        glGenBuffers(1, &slot.pbo);
+    }
+    for (uint32_t i = 0; i < encoder_count; i++) {
+        _encoders.emplace_back(&FrameCapture::encoder_loop, this);
+    }
+}
+
+FrameCapture::~FrameCapture() {
+    while (! _in_flight.empty()) {
+        retire_ready(true);
+    }
+    {
+        std::lock_guard lock(_mutex);
+        _quit = true;
+    }
+    _cv.notify_all();
+    for (auto & encoder : _encoders) {
+        encoder.join();
+    }
+    for (auto & slot : _ring) {
+        glDeleteBuffers(1, &slot.pbo);
+    }
+}
+
+bool FrameCapture::capture(int width, int height, const fs::path & path, bool wait) {
+    return read_back(width, height, path, wait, true);
+}
+
+bool FrameCapture::read_back(int width, int height, const fs::path & path, bool wait, bool announce) {
+    retire_ready(false);
+    if (_in_flight.size() == _ring.size()) {
+        if (! wait) {
+            return false;
+        }
+        retire_ready(true);
+    }
+
+    Slot * slot = nullptr;
+    for (auto & s : _ring) {
+        if (s.fence == nullptr) {
+            slot = &s;
+            break;
+        }
+    }
+
+    size_t size = (size_t) width * height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    if (slot->capacity < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot->capacity = size;
+    }
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->fence    = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->width    = width;
+    slot->height   = height;
+    slot->path     = path;
+    slot->announce = announce;
+    _in_flight.push_back(slot);
+    return true;
+}
+
+void FrameCapture::start_sequence(const fs::path & directory, uint32_t every_nth_frame) {
+    fs::create_directories(directory);
+    _sequence_directory = directory;
+    _sequence_every     = every_nth_frame == 0 ? 1 : every_nth_frame;
+    _sequence_index     = 0;
+    _sequence_active    = true;
+    std::cout << "capturing every " << _sequence_every << " frame(s) to " << fs::absolute(directory).string() << std::endl;
+}
+
+void FrameCapture::stop_sequence() {
+    _sequence_active = false;
+}
+
+bool FrameCapture::sequence_active() const {
+    return _sequence_active;
+}
+
+void FrameCapture::on_frame(int width, int height) {
+    if (_sequence_active && _frame_index % _sequence_every == 0) {
+        size_t queued;
+        {
+            std::lock_guard lock(_mutex);
+            queued = _jobs.size() + _active_encodes;
+        }
+        std::stringstream name;
+        name << "frame-" << std::setw(6) << std::setfill('0') << _sequence_index << ".png";
+        // never stall an interactive session for a sequence frame, nor let
+        // frames pile up in memory when the encoders fall behind
+        if (queued < _max_queued_encodes && read_back(width, height, _sequence_directory / name.str(), false, false)) {
+            _sequence_index++;
+        } else {
+            _frames_dropped++;
+        }
+    }
+    _frame_index++;
+    retire_ready(false);
+}
+
+FrameCapture::Stats FrameCapture::stats() const {
+    std::lock_guard lock(_mutex);
+    Stats           stats {};
+    stats.pending_readbacks = _in_flight.size();
+    stats.queued_encodes    = _jobs.size() + _active_encodes;
+    stats.frames_written    = _frames_written;
+    stats.frames_dropped    = _frames_dropped;
+    stats.frames_failed     = _frames_failed;
+    if (_frames_written > 0) {
+        stats.encode_ms = (float) (_encode_seconds * 1000.0 / _frames_written);
+    }
+    if (_encode_seconds > 0.0) {
+        stats.encode_mb_per_sec = (float) (_bytes_encoded / _encode_seconds / (1024.0 * 1024.0));
+    }
+    return stats;
+}
+
+void FrameCapture::retire_ready(bool block_oldest) {
+    while (! _in_flight.empty()) {
+        Slot *   slot    = _in_flight.front();
+        GLuint64 timeout = block_oldest ? GL_TIMEOUT_IGNORED : 0;
+        GLenum   status  = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            return;
+        }
+        _in_flight.pop_front();
+        retire(*slot);
+        block_oldest = false;
+    }
+}
+
+void FrameCapture::retire(Slot & slot) {
+    MICROPROFILE_SCOPEI("Capture", "Retire", 0x6d597a);
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    EncodeJob job { {}, slot.width, slot.height, std::move(slot.path), slot.announce };
+    size_t    size = (size_t) slot.width * slot.height * 4;
+    job.pixels.resize(size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    auto * mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (mapped != nullptr) {
+        std::memcpy(job.pixels.data(), mapped, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (mapped == nullptr) {
+        std::cerr << "failed to map capture buffer for " << job.path.string() << std::endl;
+        return;
+    }
+
+    {
+        std::lock_guard lock(_mutex);
+        _jobs.emplace_back(std::move(job));
+    }
+    _cv.notify_one();
+}
+
+void FrameCapture::encoder_loop() {
+    using Clock = std::chrono::steady_clock;
+    MicroProfileOnThreadCreate("CaptureEncoder");
+    while (true) {
+        EncodeJob job;
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [this] { return _quit || ! _jobs.empty(); });
+            if (_jobs.empty()) {
+                MicroProfileOnThreadExit();
+                return;
+            }
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+            _active_encodes++;
+        }
+
+        auto start = Clock::now();
+        bool written;
+        {
+            MICROPROFILE_SCOPEI("Capture", "Encode", 0x6d597a);
+            written = encode(job);
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+
+        std::lock_guard lock(_mutex);
+        _active_encodes--;
+        if (! written) {
+            _frames_failed++;
+            continue;
+        }
+        _frames_written++;
+        _bytes_encoded += job.pixels.size();
+        _encode_seconds += elapsed.count();
+    }
+}
+
+bool FrameCapture::encode(const EncodeJob & job) {
+    auto path = job.path.string();
+    int  ok   = stbi_write_png(path.c_str(), job.width, job.height, 4, job.pixels.data(), 0);
+    if (! ok) {
+        std::cerr << "failed to write " << path << std::endl;
+    } else if (job.announce) {
+        std::cout << "screen shot written to " << path << std::endl;
+    }
+    return ok != 0;
+}
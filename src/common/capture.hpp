@@ -0,0 +1,94 @@
+#pragma once
+
+#include "data.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <GL/glew.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Reads back the default framebuffer through a ring of pixel buffer objects
+// and encodes the images on background threads, so neither the readback nor
+// the encoding stalls the render loop.
+class FrameCapture {
+public:
+    struct Stats {
+        size_t   pending_readbacks; // frames still owned by the GPU
+        size_t   queued_encodes;    // frames waiting for or inside an encoder
+        uint64_t frames_written;
+        uint64_t frames_dropped;    // sequence frames skipped on a full ring or encode queue
+        uint64_t frames_failed;     // frames the encoder could not write
+        float    encode_ms;         // average encode time of one frame
+        float    encode_mb_per_sec; // raw pixel bytes encoded per busy second
+    };
+
+    explicit FrameCapture(uint32_t ring_size = 3, uint32_t encoder_count = 2);
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture &)             = delete;
+    FrameCapture & operator=(const FrameCapture &) = delete;
+
+    // Queues a readback of the current back buffer. With `wait` the oldest
+    // readback is retired synchronously if the ring is full, otherwise the
+    // frame is dropped and false is returned.
+    bool capture(int width, int height, const fs::path & path, bool wait = true);
+
+    // Writes every `every_nth_frame`-th frame into `directory` until stopped.
+    void start_sequence(const fs::path & directory, uint32_t every_nth_frame);
+    void stop_sequence();
+    bool sequence_active() const;
+
+    // Must be called once per frame on the GL thread, before the swap.
+    void on_frame(int width, int height);
+
+    Stats stats() const;
+
+private:
+    struct Slot {
+        GLuint   pbo {};
+        GLsync   fence {};
+        size_t   capacity {};
+        int      width {}, height {};
+        fs::path path;
+        bool     announce {};
+    };
+
+    struct EncodeJob {
+        std::vector<uint8_t> pixels;
+        int                  width, height;
+        fs::path             path;
+        bool                 announce;
+    };
+
+    bool read_back(int width, int height, const fs::path & path, bool wait, bool announce);
+    void retire_ready(bool block_oldest);
+    void retire(Slot & slot);
+    void encoder_loop();
+    static bool encode(const EncodeJob & job);
+
+    std::vector<Slot>  _ring;
+    std::deque<Slot *> _in_flight;
+
+    bool     _sequence_active = false;
+    fs::path _sequence_directory;
+    uint32_t _sequence_every = 1;
+    uint64_t _frame_index    = 0;
+    uint64_t _sequence_index = 0;
+    uint64_t _frames_dropped = 0;
+
+    mutable std::mutex      _mutex;
+    std::condition_variable _cv;
+    std::deque<EncodeJob>   _jobs;
+    size_t                  _active_encodes = 0;
+    // sequence frames waiting for or inside an encoder at most
+    size_t                  _max_queued_encodes;
+    uint64_t                _frames_written = 0;
+    uint64_t                _frames_failed  = 0;
+    uint64_t                _bytes_encoded  = 0;
+    double                  _encode_seconds = 0.0;
+    bool                    _quit           = false;
+
+    std::vector<std::thread> _encoders;
+};
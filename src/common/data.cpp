@@ -1,17 +1,152 @@
 #include "data.hpp"
 #include <config.h>
 #include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// maps the file, returns nullptr if the platform or the file does not allow it
+const uint8_t *map_file(const fs::path &path, size_t &size) {
+#ifdef _WIN32
+  HANDLE file = CreateFileW(path.c_str(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            nullptr,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return nullptr;
+  }
+  HANDLE mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+  // the view keeps the mapping alive
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (data == nullptr) {
+    return nullptr;
+  }
+  size = (size_t)file_size.QuadPart;
+  return (const uint8_t *)data;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  size = (size_t)st.st_size;
+  return (const uint8_t *)data;
+#endif
+}
+} // namespace
+
+MappedFile::MappedFile(const fs::path &path) {
+  _data = map_file(path, _size);
+  if (_data != nullptr) {
+    _mapped = true;
+    return;
+  }
+
+  std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+  if (!ifs) {
+    throw std::runtime_error("failed to open " + path.string());
+  }
+  _buffer.resize((size_t)ifs.tellg());
+  ifs.seekg(0);
+  ifs.read((char *)_buffer.data(), (std::streamsize)_buffer.size());
+  _data = _buffer.data();
+  _size = _buffer.size();
+}
+
+MappedFile::~MappedFile() {
+  unmap();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    _mapped = std::exchange(other._mapped, false);
+    _size = std::exchange(other._size, 0);
+    _buffer = std::move(other._buffer);
+    _data = _mapped ? other._data : _buffer.data();
+    other._data = nullptr;
+  }
+  return *this;
+}
+
+std::span<const uint8_t> MappedFile::bytes() const {
+  return {_data, _size};
+}
+
+bool MappedFile::mapped() const {
+  return _mapped;
+}
+
+void MappedFile::unmap() {
+  if (!_mapped) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(_data);
+#else
+  munmap((void *)_data, _size);
+#endif
+  _mapped = false;
+  _data = nullptr;
+  _size = 0;
+}
 
 fs::path Data::data_path() {
   return DATA_PATH;
 }
 
+fs::path Data::cache_path() {
+  return data_path().parent_path() / "cache";
+}
+
+MappedFile Data::map(const fs::path &name) {
+  return MappedFile(resolve(name));
+}
+
 std::vector<uint8_t> Data::load(const fs::path &name) {
-  auto full_path = resolve(name);
-  std::ifstream ifs(full_path);
-  return {std::istreambuf_iterator<char>(ifs), {}};
+  auto file = map(name);
+  auto bytes = file.bytes();
+  return {bytes.begin(), bytes.end()};
 }
 
 fs::path Data::resolve(const fs::path &name) {
   return data_path() / name;
-}
\ No newline at end of file
+}
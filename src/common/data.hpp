@@ -1,13 +1,41 @@
 #pragma once
 
 #include <filesystem>
+#include <span>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+// Read-only view of a whole file. The file is memory mapped where possible
+// and read into a buffer with a single read otherwise, the bytes stay valid
+// for the lifetime of the object.
+class MappedFile {
+public:
+  explicit MappedFile(const fs::path &path);
+  ~MappedFile();
+
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::span<const uint8_t> bytes() const;
+  bool mapped() const;
+
+private:
+  void unmap();
+
+  const uint8_t *_data = nullptr;
+  size_t _size = 0;
+  bool _mapped = false;
+  std::vector<uint8_t> _buffer;
+};
+
 class Data {
 public:
   static fs::path data_path();
+  static fs::path cache_path();
+  static MappedFile map(const fs::path &name);
   static std::vector<uint8_t> load(const fs::path &name);
   static fs::path resolve(const fs::path& name);
-};
\ No newline at end of file
+};
@@ -0,0 +1,242 @@
+#include "frame_pacing.hpp"
+#include "profile.h"
+#include <algorithm>
+#include <imgui/imgui.h>
+#include <string>
+
+namespace {
+    // one color per frame in both rows, so submit and execution line up
+    const ImU32 FRAME_COLORS[] = {
+        IM_COL32(231, 111, 81, 255),
+        IM_COL32(42, 157, 143, 255),
+        IM_COL32(233, 196, 106, 255),
+        IM_COL32(69, 123, 157, 255),
+    };
+} // namespace
+
+FramePacer::FramePacer(uint32_t frames_in_flight, bool low_latency, size_t history):
+    _frames(history), _frames_in_flight(std::clamp(frames_in_flight, 1u, MAX_FRAMES_IN_FLIGHT)), _low_latency(low_latency), _start(std::chrono::steady_clock::now()) {
+    for (auto & slot : _slots) {
+        glGenQueries(2, slot.queries.data());
+    }
+    calibrate();
+}
+
+FramePacer::~FramePacer() {
+    for (auto & slot : _slots) {
+        if (slot.fence != nullptr) {
+            glDeleteSync(slot.fence);
+        }
+        glDeleteQueries(2, slot.queries.data());
+    }
+}
+
+void FramePacer::begin_frame() {
+    MICROPROFILE_SCOPEI("Pacing", "Wait", 0x8d99ae);
+    auto start = now_ms();
+    for (auto & slot : _slots) {
+        if (slot.fence != nullptr && glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) != GL_TIMEOUT_EXPIRED) {
+            resolve(slot);
+        }
+    }
+    // fences signal in order, waiting on the oldest frame frees its slot,
+    // which is the one this frame reuses once the queue is full
+    while (queued() >= limit()) {
+        Slot * oldest = nullptr;
+        for (auto & slot : _slots) {
+            if (slot.fence != nullptr && (oldest == nullptr || slot.frame < oldest->frame)) {
+                oldest = &slot;
+            }
+        }
+        GLenum status;
+        do {
+            status = glClientWaitSync(oldest->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        resolve(*oldest);
+    }
+    if (_frame % CALIBRATE_FRAMES == 0) {
+        calibrate();
+    }
+
+    Frame frame {};
+    frame.index     = ++_frame;
+    frame.cpu_begin = now_ms();
+    frame.wait_ms   = (float) (frame.cpu_begin - start);
+    _frames.push(frame);
+
+    auto & slot = _slots[_frame % MAX_FRAMES_IN_FLIGHT];
+    slot.frame  = _frame;
+    glQueryCounter(slot.queries[0], GL_TIMESTAMP);
+}
+
+void FramePacer::end_frame() {
+    auto & slot = _slots[_frame % MAX_FRAMES_IN_FLIGHT];
+    glQueryCounter(slot.queries[1], GL_TIMESTAMP);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    if (auto * frame = find_frame(_frame)) {
+        frame->cpu_submit = now_ms();
+    }
+}
+
+void FramePacer::set_frames_in_flight(uint32_t frames) {
+    _frames_in_flight = std::clamp(frames, 1u, MAX_FRAMES_IN_FLIGHT);
+}
+
+uint32_t FramePacer::frames_in_flight() const {
+    return _frames_in_flight;
+}
+
+void FramePacer::set_low_latency(bool enabled) {
+    _low_latency = enabled;
+}
+
+bool FramePacer::low_latency() const {
+    return _low_latency;
+}
+
+uint32_t FramePacer::limit() const {
+    return _low_latency ? 1 : _frames_in_flight;
+}
+
+FramePacer::Stats FramePacer::stats() const {
+    Stats  stats {};
+    size_t count = 0, overlaps = 0;
+    for (size_t i = 0; i < _frames.size(); i++) {
+        auto & frame = _frames[i];
+        if (frame.gpu_end == 0.0) {
+            continue;
+        }
+        stats.latency_ms += (float) (frame.gpu_end - frame.cpu_begin);
+        stats.cpu_ms += (float) (frame.cpu_submit - frame.cpu_begin);
+        stats.gpu_ms += (float) (frame.gpu_end - frame.gpu_begin);
+        stats.wait_ms += frame.wait_ms;
+        count++;
+        if (i > 0 && _frames[i - 1].gpu_end != 0.0) {
+            auto & previous = _frames[i - 1];
+            auto   overlap  = std::min(frame.cpu_submit, previous.gpu_end) - std::max(frame.cpu_begin, previous.gpu_begin);
+            stats.overlap_ms += (float) std::max(overlap, 0.0);
+            overlaps++;
+        }
+    }
+    if (count > 0) {
+        stats.latency_ms /= (float) count;
+        stats.cpu_ms /= (float) count;
+        stats.gpu_ms /= (float) count;
+        stats.wait_ms /= (float) count;
+    }
+    if (overlaps > 0) {
+        stats.overlap_ms /= (float) overlaps;
+    }
+    stats.queued = queued();
+    return stats;
+}
+
+const FixSizeQueue<FramePacer::Frame> & FramePacer::frames() const {
+    return _frames;
+}
+
+void FramePacer::draw_timeline(bool * open) {
+    if (! ImGui::Begin("Frame Pacing", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+
+    int frames = (int) _frames_in_flight;
+    if (ImGui::SliderInt("Frames In Flight", &frames, 1, (int) MAX_FRAMES_IN_FLIGHT)) {
+        set_frames_in_flight((uint32_t) frames);
+    }
+    ImGui::Checkbox("Low Latency", &_low_latency);
+    auto summary = stats();
+    ImGui::Text("queued %u of %u, %.2f ms waited per frame", summary.queued, limit(), summary.wait_ms);
+    ImGui::Text("CPU %.2f ms  GPU %.2f ms  overlap %.2f ms", summary.cpu_ms, summary.gpu_ms, summary.overlap_ms);
+    ImGui::Text("latency %.2f ms from frame start to GPU done", summary.latency_ms);
+    ImGui::SliderFloat("Span (ms)", &_timeline_ms, 20.0f, 500.0f, "%.0f");
+
+    // CPU from the end of the wait until the swap on the top row, the GPU
+    // work of the same frames below, the newest frame on the right
+    const float label = 40.0f, width = 600.0f, row = 22.0f, gap = 4.0f;
+    ImVec2      origin = ImGui::GetCursorScreenPos();
+    ImGui::Dummy(ImVec2(label + width, 2.0f * row + gap));
+    auto * draw  = ImGui::GetWindowDrawList();
+    double right = now_ms();
+    double left  = right - _timeline_ms;
+    auto   x     = [&](double t) {
+        return origin.x + label + (float) std::clamp((t - left) / _timeline_ms, 0.0, 1.0) * width;
+    };
+    ImVec2 canvas(origin.x + label, origin.y);
+    ImVec2 canvas_end(origin.x + label + width, origin.y + 2.0f * row + gap);
+    draw->AddText(ImVec2(origin.x, origin.y + 2.0f), ImGui::GetColorU32(ImGuiCol_Text), "CPU");
+    draw->AddText(ImVec2(origin.x, origin.y + row + gap + 2.0f), ImGui::GetColorU32(ImGuiCol_Text), "GPU");
+    draw->AddRectFilled(canvas, canvas_end, IM_COL32(30, 30, 30, 255));
+    draw->PushClipRect(canvas, canvas_end, true);
+    auto bar = [&](double begin, double end, float top, ImU32 color, uint64_t index) {
+        if (end < left) {
+            return;
+        }
+        ImVec2 min(x(begin), top), max(x(end), top + row);
+        draw->AddRectFilled(min, max, color);
+        auto text = std::to_string(index % 1000);
+        if (max.x - min.x > ImGui::CalcTextSize(text.c_str()).x + 4.0f) {
+            draw->AddText(ImVec2(min.x + 2.0f, top + 2.0f), IM_COL32(0, 0, 0, 255), text.c_str());
+        }
+    };
+    for (size_t i = 0; i < _frames.size(); i++) {
+        auto & frame = _frames[i];
+        auto   color = FRAME_COLORS[frame.index % IM_ARRAYSIZE(FRAME_COLORS)];
+        if (frame.wait_ms > 0.0f) {
+            draw->AddRectFilled(ImVec2(x(frame.cpu_begin - frame.wait_ms), origin.y + row * 0.25f), ImVec2(x(frame.cpu_begin), origin.y + row * 0.75f), IM_COL32(110, 110, 110, 255));
+        }
+        // the frame drawing this is not submitted yet
+        bar(frame.cpu_begin, frame.cpu_submit > 0.0 ? frame.cpu_submit : right, origin.y, color, frame.index);
+        if (frame.gpu_end > 0.0) {
+            bar(frame.gpu_begin, frame.gpu_end, origin.y + row + gap, color, frame.index);
+        }
+    }
+    draw->PopClipRect();
+    ImGui::End();
+}
+
+double FramePacer::now_ms() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+}
+
+void FramePacer::calibrate() {
+    // the GL time once previous commands reached the server, without waiting
+    // for them to execute
+    GLint64 gpu = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpu);
+    _gpu_offset_ms = now_ms() - (double) gpu / 1.0e6;
+}
+
+void FramePacer::resolve(Slot & slot) {
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(slot.queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(slot.queries[1], GL_QUERY_RESULT, &end);
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    if (auto * frame = find_frame(slot.frame)) {
+        frame->gpu_begin = (double) begin / 1.0e6 + _gpu_offset_ms;
+        frame->gpu_end   = (double) end / 1.0e6 + _gpu_offset_ms;
+    }
+}
+
+FramePacer::Frame * FramePacer::find_frame(uint64_t index) {
+    if (_frames.empty() || index > _frames.back().index) {
+        return nullptr;
+    }
+    auto offset = _frames.back().index - index;
+    if (offset >= _frames.size()) {
+        return nullptr;
+    }
+    return &_frames[_frames.size() - 1 - offset];
+}
+
+uint32_t FramePacer::queued() const {
+    uint32_t count = 0;
+    for (auto & slot : _slots) {
+        if (slot.fence != nullptr) {
+            count++;
+        }
+    }
+    return count;
+}
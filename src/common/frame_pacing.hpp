@@ -0,0 +1,93 @@
+#pragma once
+
+#include "utils.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <GL/glew.h>
+
+// Bounds how many frames the CPU may queue ahead of the GPU. A fence is
+// placed after every swap, and before a frame starts the CPU waits until
+// fewer than frames_in_flight() frames are unfinished, so the CPU builds
+// frame N+1 while the GPU executes frame N without the driver queueing
+// frames, and input latency, beyond the limit. Timestamp queries around
+// each frame are converted to the CPU clock to compare when a frame was
+// submitted with when the GPU worked on it.
+class FramePacer {
+public:
+    // also the number of regions ring buffers need to never wait
+    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
+    // Times in ms since the pacer was created, GPU times are 0 until the
+    // frame is resolved
+    struct Frame {
+        uint64_t index;
+        double   cpu_begin;  // after the wait, before polling input
+        double   cpu_submit; // after the swap
+        double   gpu_begin, gpu_end;
+        float    wait_ms;    // blocked on an earlier frame before cpu_begin
+    };
+
+    // Averages over the resolved frames of the history
+    struct Stats {
+        float    latency_ms; // from cpu_begin until the GPU finished
+        float    cpu_ms;     // from cpu_begin until cpu_submit
+        float    gpu_ms;     // from gpu_begin until gpu_end
+        float    overlap_ms; // CPU work of a frame during the GPU work of the previous one
+        float    wait_ms;
+        uint32_t queued;     // frames not finished by the GPU right now
+    };
+
+    FramePacer(uint32_t frames_in_flight = 2, bool low_latency = false, size_t history = 120);
+    ~FramePacer();
+
+    FramePacer(const FramePacer &)             = delete;
+    FramePacer & operator=(const FramePacer &) = delete;
+
+    // Waits for the GPU to finish enough frames, call before polling input
+    void begin_frame();
+    // Fences the frame, call right after the swap
+    void end_frame();
+
+    // Clamped to [1, MAX_FRAMES_IN_FLIGHT]
+    void     set_frames_in_flight(uint32_t frames);
+    uint32_t frames_in_flight() const;
+    // Caps the queue to a single frame, so every frame starts, and samples
+    // input, only once the GPU is idle
+    void     set_low_latency(bool enabled);
+    bool     low_latency() const;
+    // Frames allowed in flight with the low latency mode applied
+    uint32_t limit() const;
+
+    Stats                       stats() const;
+    const FixSizeQueue<Frame> & frames() const;
+
+    void draw_timeline(bool * open);
+
+private:
+    struct Slot {
+        GLsync                fence {};
+        std::array<GLuint, 2> queries {};
+        uint64_t              frame = 0;
+    };
+
+    // Frames between two calibrations of the GPU clock
+    static constexpr uint64_t CALIBRATE_FRAMES = 300;
+
+    double   now_ms() const;
+    void     calibrate();
+    // Reads the timestamps of a finished slot into its frame
+    void     resolve(Slot & slot);
+    Frame *  find_frame(uint64_t index);
+    uint32_t queued() const;
+
+    std::array<Slot, MAX_FRAMES_IN_FLIGHT> _slots;
+    FixSizeQueue<Frame>                    _frames;
+    uint64_t                               _frame = 0;
+    uint32_t                               _frames_in_flight;
+    bool                                   _low_latency;
+    std::chrono::steady_clock::time_point  _start;
+    // CPU ms minus GPU ms of the same instant
+    double                                 _gpu_offset_ms = 0.0;
+    float                                  _timeline_ms   = 100.0f;
+};
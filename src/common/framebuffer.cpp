@@ -1,4 +1,5 @@
 #include "framebuffer.hpp"
+#include <vector>
 
 Framebuffer::Framebuffer(Texture2D **color_attachments,
                          uint32_t color_attachment_count,
@@ -16,12 +17,18 @@ void Framebuffer::init(Texture2D **color_attachments,
   glGenFramebuffers(1, &_id);
   glBindFramebuffer(GL_FRAMEBUFFER, _id);
 
+  std::vector<GLenum> draw_buffers;
   for (uint32_t i = 0; i < color_attachment_count; i++) {
     glFramebufferTexture2D(GL_FRAMEBUFFER,
                            GL_COLOR_ATTACHMENT0 + i,
                            GL_TEXTURE_2D,
                            color_attachments[i]->get(),
                            0);
+    draw_buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+  }
+  if (color_attachment_count > 1) {
+    // only the first attachment is written by default
+    glDrawBuffers((GLsizei)draw_buffers.size(), draw_buffers.data());
   }
 
   if (depth_stencil_attachment != nullptr) {
@@ -1,35 +1,193 @@
 #include "gltf.hpp"
 #include "data.hpp"
+#include "profile.h"
+#include "scene_cache.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <tiny_gltf.h>
 
-Gltf::Gltf(const fs::path &name) {
-  load_model(name);
+struct Gltf::Staging {
+  struct Primitive {
+    int mesh;
+    int material;
+    // accessors of the vertex_attributes and of the indices, -1 where the
+    // file has none or an unsupported one
+    std::array<int, 6> attributes;
+    int indices;
+    std::vector<int> buffers; // the file buffers they read from
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint32_t first_vertex;
+    uint32_t first_index;
+    uint32_t batch;
+    // written by the conversion
+    Bounds bounds;
+    float uv_density;
+  };
+
+  struct Texture {
+    // identifies the texture across scenes, empty for embedded images
+    std::string key;
+    int image;
+    GLenum type;
+    int width;
+    int height;
+    int channels;
+    TextureSettings settings;
+    // base color textures are uploaded as a layer of a page instead
+    bool paged = false;
+  };
+
+  std::vector<Primitive> primitives;
+  std::vector<Texture> textures;
+  std::vector<std::vector<unsigned char>> images;
+  std::vector<std::pair<int, int>> layers; // (page, layer) in upload order
+  std::vector<MaterialData> material_data;
+  uint32_t vertex_count = 0;
+  uint32_t index_count = 0;
+  fs::path name;
+  fs::path directory;
+  SceneCache *cache = nullptr;
+  size_t uploaded = 0;
+  // progress of load_model, written by the loading thread
+  std::atomic<float> progress{0.0f};
+  size_t peak_resident_before = 0;
+
+  // The parsed file, kept until the primitives are converted. Each buffer
+  // is freed as soon as the last primitive reading it is done.
+  std::unique_ptr<tinygltf::Model> model;
+  std::unique_ptr<std::atomic<int>[]> buffer_users;
+  JobSystem::Handle conversion;
+  std::atomic<size_t> converted{0};
+
+  // The first step creates the buffers and pages and starts converting the
+  // primitives into the mapped geometry, the last one waits for that to
+  // finish. Textures and page layers are uploaded in between.
+  size_t total() const {
+    return 2 + textures.size() + layers.size();
+  }
+
+  bool converting() const {
+    return uploaded + 1 == total() && !conversion.done();
+  }
+
+  // the conversion writes into the geometry and reads the model, both must
+  // outlive it even when the upload is abandoned or failed
+  ~Staging() {
+    try {
+      JobSystem::instance().wait(conversion);
+    } catch (...) {
+      // nobody is left to report it to
+    }
+  }
+};
+
+namespace {
+// Fields of Mesh::Vertex read from float attributes, for all attributes see
+// https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md
+struct VertexAttribute {
+  const char *name;
+  int type;
+  size_t offset;
+  size_t size;
+};
+
+const VertexAttribute vertex_attributes[] = {
+    {"POSITION", TINYGLTF_TYPE_VEC3, offsetof(Mesh::Vertex, position), 12},
+    {"NORMAL", TINYGLTF_TYPE_VEC3, offsetof(Mesh::Vertex, normal), 12},
+    {"TANGENT", TINYGLTF_TYPE_VEC4, offsetof(Mesh::Vertex, tangent), 16},
+    {"TEXCOORD_0", TINYGLTF_TYPE_VEC2, offsetof(Mesh::Vertex, uv0), 8},
+    {"TEXCOORD_1", TINYGLTF_TYPE_VEC2, offsetof(Mesh::Vertex, uv1), 8},
+    {"COLOR_0", TINYGLTF_TYPE_VEC4, offsetof(Mesh::Vertex, color), 16},
+};
+
+bool read_mapped_file(std::vector<unsigned char> *out,
+                      std::string *err,
+                      const std::string &filepath,
+                      void *) {
+  try {
+    auto file = MappedFile(filepath);
+    auto bytes = file.bytes();
+    out->assign(bytes.begin(), bytes.end());
+    return true;
+  } catch (std::exception &e) {
+    if (err != nullptr) {
+      *err += e.what();
+    }
+    return false;
+  }
+}
+} // namespace
+
+Gltf::Gltf(const fs::path &name, SceneCache *cache) {
+  Staging staging;
+  staging.cache = cache;
+  load_model(name, staging);
+  while (upload_next(staging)) {
+  }
 }
 
-void Gltf::load_model(const fs::path &name) {
+void Gltf::load_model(const fs::path &name, Staging &staging) {
+  MICROPROFILE_SCOPEI("Gltf", "LoadModel", 0x3d7ab8);
   tinygltf::TinyGLTF loader;
-  tinygltf::Model model;
+  staging.model = std::make_unique<tinygltf::Model>();
+  auto &model = *staging.model;
   std::string err;
   std::string warn;
 
+  staging.name = name;
+  staging.peak_resident_before = peak_resident_bytes();
   auto model_path = Data::resolve(name);
+  staging.directory = model_path.parent_path();
   bool ret = false;
   auto extension = model_path.extension();
-  auto model_path_str = model_path.string();
-  if (extension == ".gltf") {
-    ret = loader.LoadASCIIFromFile(&model, &err, &warn, model_path_str.c_str());
-  } else if (extension == ".glb") {
-    ret =
-        loader.LoadBinaryFromFile(&model, &err, &warn, model_path_str.c_str());
-  } else {
-    std::stringstream ss;
-    ss << "invalid file extension for GLTF: " << extension
-       << ", should be .gltf or .glb";
-    throw std::runtime_error(ss.str());
+  auto base_dir = staging.directory.string();
+  // tinygltf keeps its own copy of buffers and images, but they are copied
+  // once out of a mapping instead of being streamed through an ifstream
+  tinygltf::FsCallbacks callbacks{&tinygltf::FileExists,
+                                  &tinygltf::ExpandFilePath,
+                                  &read_mapped_file,
+                                  &tinygltf::WriteWholeFile,
+                                  nullptr};
+  loader.SetFsCallbacks(callbacks);
+  {
+    // tinygltf only, the steps after it have scopes of their own
+    MICROPROFILE_SCOPEI("Gltf", "Parse", 0x5b93c7);
+    if (extension == ".gltf") {
+      auto file = MappedFile(model_path);
+      auto bytes = file.bytes();
+      ret = loader.LoadASCIIFromString(&model,
+                                       &err,
+                                       &warn,
+                                       (const char *)bytes.data(),
+                                       (unsigned int)bytes.size(),
+                                       base_dir);
+    } else if (extension == ".glb") {
+      auto file = MappedFile(model_path);
+      auto bytes = file.bytes();
+      ret = loader.LoadBinaryFromMemory(&model,
+                                        &err,
+                                        &warn,
+                                        bytes.data(),
+                                        (unsigned int)bytes.size(),
+                                        base_dir);
+    } else {
+      std::stringstream ss;
+      ss << "invalid file extension for GLTF: " << extension
+         << ", should be .gltf or .glb";
+      throw std::runtime_error(ss.str());
+    }
   }
   if (!warn.empty()) {
     std::cout << "Warn: " << warn << std::endl;
@@ -42,14 +200,197 @@ void Gltf::load_model(const fs::path &name) {
     throw std::runtime_error("failed to parse " + model_path.string());
   }
 
+  staging.progress = 0.5f;
   if (model.scenes.size() == 0) {
+    staging.progress = 1.0f;
     return;
   }
 
-  load_meshes(model);
-  load_textures(model);
+  load_meshes(model, staging);
+  load_textures(model, staging);
   load_materials(model);
+  load_pages(staging);
   load_scene(model);
+  load_animations(model);
+  load_batches(staging);
+  staging.progress = 1.0f;
+}
+
+bool Gltf::upload_next(Staging &staging) {
+  MICROPROFILE_SCOPEI("Gltf", "Upload", 0x2a9d8f);
+  auto index = staging.uploaded;
+  auto texture_end = 1 + staging.textures.size();
+  auto layer_end = texture_end + staging.layers.size();
+  if (index == 0) {
+    geometry =
+        std::make_unique<Mesh>(staging.vertex_count, staging.index_count);
+    _gpu_bytes += staging.vertex_count * sizeof(Mesh::Vertex) +
+                  staging.index_count * sizeof(uint32_t);
+    if (staging.material_data.empty()) {
+      staging.material_data.push_back(MaterialData{glm::vec4(1.0f), {}});
+    }
+    auto material_size = staging.material_data.size() * sizeof(MaterialData);
+    material_buffer =
+        std::make_unique<Buffer>(staging.material_data.data(), material_size);
+    material_texture =
+        std::make_unique<TextureBuffer>(GL_RGBA32F, material_buffer->get());
+    _gpu_bytes += material_size;
+    auto instance_size = _instances.size() * sizeof(InstanceData);
+    instance_buffer = std::make_unique<Buffer>(
+        _instances.data(), instance_size, GL_DYNAMIC_DRAW);
+    instance_texture =
+        std::make_unique<TextureBuffer>(GL_RGBA32F, instance_buffer->get());
+    _gpu_bytes += instance_size;
+    // only the mip tails, the streamer asks for the finer levels
+    for (auto &source : page_sources) {
+      auto level = source.resident_level;
+      pages.push_back(std::make_unique<Texture2DArray>(
+          source.type,
+          std::max(source.width >> level, 1),
+          std::max(source.height >> level, 1),
+          (int)source.textures.size(),
+          source.levels() - level,
+          &source.settings));
+    }
+    Mesh::Vertex *vertices;
+    uint32_t *indices;
+    geometry->map(&vertices, &indices);
+    staging.conversion =
+        JobSystem::instance().submit([&staging, vertices, indices] {
+          convert_primitives(staging, vertices, indices);
+          staging.model.reset();
+        });
+  } else if (index < texture_end) {
+    auto &tex = staging.textures[index - 1];
+    std::shared_ptr<Texture2D> texture;
+    size_t bytes = 0;
+    if (!tex.paged) {
+      if (staging.cache != nullptr && !tex.key.empty()) {
+        texture = staging.cache->find_texture(tex.key);
+      }
+      if (texture == nullptr) {
+        texture = std::make_shared<Texture2D>(staging.images[tex.image].data(),
+                                              tex.type,
+                                              tex.width,
+                                              tex.height,
+                                              tex.channels,
+                                              &tex.settings);
+        if (staging.cache != nullptr && !tex.key.empty()) {
+          staging.cache->insert_texture(tex.key, texture);
+        }
+      }
+      // including the mip chain
+      size_t component_size = tex.type == GL_UNSIGNED_SHORT ? 2 : 1;
+      bytes = (size_t)tex.width * tex.height * tex.channels * component_size *
+              4 / 3;
+    }
+    texture_bytes.push_back(bytes);
+    textures.push_back(std::move(texture));
+  } else if (index < layer_end) {
+    auto [page_index, layer] = staging.layers[index - texture_end];
+    auto &source = page_sources[page_index];
+    for (int level = source.resident_level; level < source.levels(); level++) {
+      pages[page_index]->upload_layer(
+          layer,
+          level - source.resident_level,
+          &source.layers[layer][source.level_offsets[level]]);
+    }
+  } else if (index < staging.total()) {
+    JobSystem::instance().wait(staging.conversion);
+    if (!geometry->unmap()) {
+      throw std::runtime_error("lost the geometry of " +
+                               staging.name.string() + " while uploading");
+    }
+    for (auto &prim : staging.primitives) {
+      auto &bounds = mesh_bounds[prim.mesh];
+      bounds.min = glm::min(bounds.min, prim.bounds.min);
+      bounds.max = glm::max(bounds.max, prim.bounds.max);
+      auto &batch = batches[prim.mesh][prim.batch];
+      batch.uv_density = std::max(batch.uv_density, prim.uv_density);
+    }
+    std::cout << "loaded " << staging.name.string() << ", peak resident "
+              << (peak_resident_bytes() >> 20) << " MB ("
+              << (staging.peak_resident_before >> 20) << " MB before)"
+              << std::endl;
+  } else {
+    return false;
+  }
+  staging.uploaded++;
+  return true;
+}
+
+Gltf::Bounds Gltf::draw_bounds(uint32_t draw) const {
+  auto &local = mesh_bounds[draws[draw].index];
+  auto &transform = draws[draw].transform;
+  // the box around the transformed box, per axis from the matrix columns
+  auto center = glm::vec3(transform * glm::vec4((local.min + local.max) * 0.5f, 1.0f));
+  auto extent = (local.max - local.min) * 0.5f;
+  glm::vec3 half(0.0f);
+  for (int axis = 0; axis < 3; axis++) {
+    half += glm::abs(glm::vec3(transform[axis])) * extent[axis];
+  }
+  return Bounds{center - half, center + half};
+}
+
+void Gltf::set_transform(uint32_t draw, const glm::mat4 &transform) {
+  draws[draw].transform = transform;
+  auto instance = draw_instances[draw];
+  _instances[instance] = InstanceData{
+      transform, glm::mat3x4(glm::transpose(glm::inverse(glm::mat3(transform))))};
+  if (_dirty_begin == _dirty_end) {
+    _dirty_begin = instance;
+    _dirty_end = instance + 1;
+  } else {
+    _dirty_begin = std::min(_dirty_begin, (size_t)instance);
+    _dirty_end = std::max(_dirty_end, (size_t)instance + 1);
+  }
+}
+
+void Gltf::flush_transforms() {
+  if (_dirty_begin == _dirty_end) {
+    return;
+  }
+  MICROPROFILE_SCOPEI("Gltf", "FlushTransforms", 0x2a9d8f);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, instance_buffer->get());
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+                  _dirty_begin * sizeof(InstanceData),
+                  (_dirty_end - _dirty_begin) * sizeof(InstanceData),
+                  &_instances[_dirty_begin]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  _dirty_begin = _dirty_end = 0;
+}
+
+size_t Gltf::gpu_bytes() const {
+  size_t page_bytes = 0;
+  for (auto &page : pages) {
+    page_bytes += page->bytes();
+  }
+  return _gpu_bytes + page_bytes;
+}
+
+size_t Gltf::cpu_bytes() const {
+  size_t animation_bytes = 0;
+  size_t page_bytes = 0;
+  for (auto &source : page_sources) {
+    for (auto &layer : source.layers) {
+      page_bytes += layer.size();
+    }
+  }
+  for (auto &animation : animations) {
+    for (auto &channel : animation.channels) {
+      animation_bytes += channel.times.size() * sizeof(float) +
+                         channel.values.size() * sizeof(glm::vec4);
+    }
+  }
+  return sizeof(Gltf) + draws.size() * sizeof(MeshDraw) +
+         nodes.size() * sizeof(Node) + animation_bytes + page_bytes +
+         mesh_bounds.size() * sizeof(Bounds) +
+         draw_instances.size() * sizeof(uint32_t) +
+         _instances.size() * sizeof(InstanceData) +
+         instance_groups.size() * sizeof(InstanceGroup) +
+         draw_order.size() * sizeof(draw_order[0]) +
+         materials.size() * sizeof(Material) +
+         textures.size() * (sizeof(std::shared_ptr<Texture2D>) + sizeof(size_t));
 }
 
 void Gltf::load_materials(tinygltf::Model &model) {
@@ -84,11 +425,291 @@ void Gltf::load_materials(tinygltf::Model &model) {
 
     materials.emplace_back(std::move(m));
   }
+
+  // for primitives without a material, see load_meshes
+  auto m = std::make_unique<Material>();
+  m->mode = Material::Opaque;
+  m->double_sided = false;
+  m->base_color_factor = glm::vec4(1.0f);
+  m->base_color = _white_tex_index;
+  m->metallic_factor = 1.0f;
+  m->roughness_factor = 1.0f;
+  m->metallic_roughness = _white_tex_index;
+  m->normal = _default_normal_tex_index;
+  m->normal_scale = 1.0f;
+  m->occlusion = _white_tex_index;
+  m->occlusion_strength = 1.0f;
+  m->emission = _white_tex_index;
+  m->emission_factor = glm::vec3(0.0f);
+  materials.emplace_back(std::move(m));
 }
 
-void Gltf::load_textures(tinygltf::Model &model) {
+namespace {
+bool same_sampler(const TextureSettings &a, const TextureSettings &b) {
+  return a.wrap_s == b.wrap_s && a.wrap_t == b.wrap_t &&
+         a.min_filter == b.min_filter && a.max_filter == b.max_filter;
+}
+
+// The next mip level of an RGBA image, each texel averages 2x2 source
+// texels. The last row or column of odd sizes is dropped like GL does.
+template <typename T>
+void downsample(const T *source, int width, int height, T *target) {
+  int target_width = std::max(width >> 1, 1);
+  int target_height = std::max(height >> 1, 1);
+  for (int y = 0; y < target_height; y++) {
+    size_t y0 = std::min(2 * y, height - 1);
+    size_t y1 = std::min(2 * y + 1, height - 1);
+    for (int x = 0; x < target_width; x++) {
+      size_t x0 = std::min(2 * x, width - 1);
+      size_t x1 = std::min(2 * x + 1, width - 1);
+      for (size_t c = 0; c < 4; c++) {
+        uint32_t sum = source[(y0 * width + x0) * 4 + c] +
+                       source[(y0 * width + x1) * 4 + c] +
+                       source[(y1 * width + x0) * 4 + c] +
+                       source[(y1 * width + x1) * 4 + c];
+        target[((size_t)y * target_width + x) * 4 + c] = (T)((sum + 2) / 4);
+      }
+    }
+  }
+}
+} // namespace
+
+int Gltf::PageSource::levels() const {
+  return (int)level_offsets.size();
+}
+
+size_t Gltf::PageSource::bytes(int level) const {
+  if (layers.empty()) {
+    return 0;
+  }
+  return (layers[0].size() - level_offsets[level]) * layers.size();
+}
+
+void Gltf::set_page_level(int page, int level) {
+  MICROPROFILE_SCOPEI("Gltf", "SetPageLevel", 0x2a9d8f);
+  auto &source = page_sources[page];
+  level = std::clamp(level, 0, source.levels() - 1);
+  if (level == source.resident_level) {
+    return;
+  }
+  // GL 3.3 cannot copy levels between textures, the ones both have in
+  // common are uploaded again. They add at most a third.
+  auto texture =
+      std::make_unique<Texture2DArray>(source.type,
+                                       std::max(source.width >> level, 1),
+                                       std::max(source.height >> level, 1),
+                                       (int)source.layers.size(),
+                                       source.levels() - level,
+                                       &source.settings);
+  for (size_t layer = 0; layer < source.layers.size(); layer++) {
+    for (int l = level; l < source.levels(); l++) {
+      texture->upload_layer(
+          (int)layer, l - level, &source.layers[layer][source.level_offsets[l]]);
+    }
+  }
+  pages[page] = std::move(texture);
+  source.resident_level = level;
+}
+
+void Gltf::load_pages(Staging &staging) {
+  // GL_MAX_ARRAY_TEXTURE_LAYERS is at least 256
+  const size_t max_layers = 256;
+  std::vector<std::pair<int, int>> placed(staging.textures.size(), {-1, 0});
+  for (auto &m : materials) {
+    m->base_color_page = -1;
+    m->base_color_layer = 0;
+    if (m->base_color == (int)_white_tex_index) {
+      continue;
+    }
+    auto &tex = staging.textures[m->base_color];
+    if (tex.width <= 0 || staging.images[tex.image].empty()) {
+      // the image failed to load
+      continue;
+    }
+    auto &location = placed[m->base_color];
+    if (location.first < 0) {
+      auto page =
+          std::find_if(page_sources.begin(), page_sources.end(), [&](auto &p) {
+            return p.width == tex.width && p.height == tex.height &&
+                   p.type == tex.type && same_sampler(p.settings, tex.settings) &&
+                   p.textures.size() < max_layers;
+          });
+      if (page == page_sources.end()) {
+        page_sources.push_back(PageSource{
+            tex.width, tex.height, tex.type, tex.settings, {}, {}, {}, 0, 0});
+        page = page_sources.end() - 1;
+      }
+      location = {(int)(page - page_sources.begin()), (int)page->textures.size()};
+      page->textures.push_back(m->base_color);
+      tex.paged = true;
+    }
+    m->base_color_page = location.first;
+    m->base_color_layer = location.second;
+  }
+
+  for (auto &source : page_sources) {
+    size_t texel = source.type == GL_UNSIGNED_SHORT ? 8 : 4;
+    size_t offset = 0;
+    for (int level = 0; level == 0 || (source.width >> level) > 0 ||
+                        (source.height >> level) > 0;
+         level++) {
+      source.level_offsets.push_back(offset);
+      offset += (size_t)std::max(source.width >> level, 1) *
+                std::max(source.height >> level, 1) * texel;
+    }
+    while (std::max(source.width, source.height) >> source.tail_level >
+           MIP_TAIL_SIZE) {
+      source.tail_level++;
+    }
+    source.resident_level = source.tail_level;
+    source.layers.resize(source.textures.size());
+    for (size_t layer = 0; layer < source.textures.size(); layer++) {
+      staging.layers.emplace_back(int(&source - page_sources.data()),
+                                  (int)layer);
+    }
+  }
+
+  // one layer per job, they are independent
+  auto &jobs = JobSystem::instance();
+  jobs.parallel_for(0, staging.layers.size(), 1, [&](size_t first, size_t last) {
+    for (size_t l = first; l < last; l++) {
+      auto [page_index, layer] = staging.layers[l];
+      auto &source = page_sources[page_index];
+      auto &tex = staging.textures[source.textures[layer]];
+      auto &image = staging.images[tex.image];
+      auto &data = source.layers[layer];
+      size_t component = tex.type == GL_UNSIGNED_SHORT ? 2 : 1;
+      size_t texels = (size_t)tex.width * tex.height;
+      // the last level is a single texel
+      data.resize(source.level_offsets.back() + 4 * component);
+      // layers are always RGBA
+      if (tex.channels == 4) {
+        std::memcpy(data.data(), image.data(), texels * 4 * component);
+      } else {
+        for (size_t i = 0; i < texels; i++) {
+          for (int c = 0; c < 4; c++) {
+            // grey images are replicated, missing alpha is opaque
+            int channel = tex.channels < 3 ? (c < 3 ? 0 : 1) : c;
+            auto *dst = &data[(i * 4 + c) * component];
+            if (channel < tex.channels) {
+              std::memcpy(dst,
+                          &image[(i * tex.channels + channel) * component],
+                          component);
+            } else {
+              std::memset(dst, 0xff, component);
+            }
+          }
+        }
+      }
+      for (int level = 1; level < source.levels(); level++) {
+        int width = std::max(tex.width >> (level - 1), 1);
+        int height = std::max(tex.height >> (level - 1), 1);
+        auto *from = &data[source.level_offsets[level - 1]];
+        auto *to = &data[source.level_offsets[level]];
+        if (component == 2) {
+          downsample((const uint16_t *)from, width, height, (uint16_t *)to);
+        } else {
+          downsample(from, width, height, to);
+        }
+      }
+    }
+  });
+
+  // the paged images are only read from page_sources from now on
+  std::vector<bool> unpaged(staging.images.size(), false);
+  for (auto &tex : staging.textures) {
+    if (!tex.paged && tex.image >= 0) {
+      unpaged[tex.image] = true;
+    }
+  }
+  for (auto &tex : staging.textures) {
+    if (tex.paged && !unpaged[tex.image]) {
+      staging.images[tex.image] = {};
+    }
+  }
+
+  for (auto &m : materials) {
+    staging.material_data.push_back(
+        MaterialData{m->base_color_factor,
+                     glm::vec4((float)m->base_color_layer,
+                               m->base_color_page >= 0 ? 1.0f : 0.0f,
+                               0.0f,
+                               0.0f)});
+  }
+}
+
+void Gltf::load_batches(Staging &staging) {
+  // lay out the indices of each mesh page by page, so that every batch is
+  // a single range
+  batches.resize(meshes.size());
+  size_t staged = 0;
+  for (size_t mesh = 0; mesh < meshes.size(); mesh++) {
+    auto &prims = meshes[mesh];
+    std::vector<size_t> order(prims.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return materials[prims[a].material]->base_color_page <
+             materials[prims[b].material]->base_color_page;
+    });
+    for (auto i : order) {
+      auto &prim = prims[i];
+      int page = materials[prim.material]->base_color_page;
+      if (batches[mesh].empty() || batches[mesh].back().page != page) {
+        batches[mesh].push_back(Batch{page, staging.index_count, 0, 0.0f});
+      }
+      prim.first_index = staging.index_count;
+      staging.primitives[staged + i].first_index = staging.index_count;
+      staging.primitives[staged + i].batch =
+          (uint32_t)batches[mesh].size() - 1;
+      batches[mesh].back().index_count += prim.index_count;
+      staging.index_count += prim.index_count;
+    }
+    staged += prims.size();
+  }
+
+  // one instance per draw, grouped by mesh
+  std::vector<uint32_t> by_mesh(draws.size());
+  std::iota(by_mesh.begin(), by_mesh.end(), 0);
+  std::stable_sort(by_mesh.begin(), by_mesh.end(), [&](auto a, auto b) {
+    return draws[a].index < draws[b].index;
+  });
+  draw_instances.resize(draws.size());
+  _instances.reserve(draws.size());
+  for (uint32_t instance = 0; instance < by_mesh.size(); instance++) {
+    auto &draw = draws[by_mesh[instance]];
+    if (instance_groups.empty() || instance_groups.back().mesh != draw.index) {
+      instance_groups.push_back(InstanceGroup{draw.index, instance, 0});
+    }
+    instance_groups.back().instance_count++;
+    draw_instances[by_mesh[instance]] = instance;
+    _instances.push_back(InstanceData{});
+  }
+
+  for (uint32_t draw = 0; draw < draws.size(); draw++) {
+    set_transform(draw, draws[draw].transform);
+  }
+  // the buffer is created from _instances
+  _dirty_begin = _dirty_end = 0;
+
+  for (uint32_t group = 0; group < instance_groups.size(); group++) {
+    auto mesh = instance_groups[group].mesh;
+    for (uint32_t batch = 0; batch < batches[mesh].size(); batch++) {
+      draw_order.emplace_back(group, batch);
+    }
+  }
+  std::stable_sort(draw_order.begin(), draw_order.end(), [&](auto &a, auto &b) {
+    return batches[instance_groups[a.first].mesh][a.second].page <
+           batches[instance_groups[b.first].mesh][b.second].page;
+  });
+}
+
+void Gltf::load_textures(tinygltf::Model &model, Staging &staging) {
+  MICROPROFILE_SCOPEI("Gltf", "LoadTextures", 0x7fb069);
   // All textures are loaded linearly. Do gamma correction in shader if
   // necessary
+  for (auto &image : model.images) {
+    staging.images.emplace_back(std::move(image.image));
+  }
   for (auto &tex : model.textures) {
     auto &image = model.images[tex.source];
     int width = image.width;
@@ -114,188 +735,348 @@ void Gltf::load_textures(tinygltf::Model &model) {
       }
     }
 
-    textures.push_back(
-        std::make_unique<Texture2D>((uint8_t *)image.image.data(),
-                                    type,
-                                    width,
-                                    height,
-                                    channels,
-                                    &settings));
+    std::string key;
+    if (!image.uri.empty() && image.uri.rfind("data:", 0) != 0) {
+      std::stringstream ss;
+      ss << (staging.directory / image.uri).lexically_normal().string() << "|"
+         << settings.wrap_s << "|" << settings.wrap_t << "|"
+         << settings.min_filter << "|" << settings.max_filter;
+      key = ss.str();
+    }
+    staging.textures.push_back(Staging::Texture{
+        std::move(key), tex.source, type, width, height, channels, settings});
   }
-  auto add_default_tex = [&](uint8_t *color) {
-    auto index = (uint32_t)(textures.size());
-    textures.push_back(
-        std::make_unique<Texture2D>(color, GL_UNSIGNED_BYTE, 1, 1, 4));
+  auto add_default_tex = [&](const char *key, uint8_t *color) {
+    auto index = (uint32_t)(staging.textures.size());
+    staging.textures.push_back(Staging::Texture{key,
+                                                (int)staging.images.size(),
+                                                GL_UNSIGNED_BYTE,
+                                                1,
+                                                1,
+                                                4,
+                                                TextureSettings{}});
+    staging.images.emplace_back(color, color + 4);
     return index;
   };
   uint8_t white[] = {255, 255, 255, 255};
   uint8_t normal[] = {128, 128, 255, 255};
-  _white_tex_index = add_default_tex(white);
-  _default_normal_tex_index = add_default_tex(normal);
+  _white_tex_index = add_default_tex("default:white", white);
+  _default_normal_tex_index = add_default_tex("default:normal", normal);
 }
 
-void Gltf::load_meshes(tinygltf::Model &model) {
-  auto make_reader = [&](int accessor_index) {
+void Gltf::load_meshes(tinygltf::Model &model, Staging &staging) {
+  MICROPROFILE_SCOPEI("Gltf", "LoadMeshes", 0x8ab17d);
+  // only the layout is decided here, convert_primitives() fills it in once
+  // the GL buffers exist
+  meshes.resize(model.meshes.size());
+  mesh_bounds.assign(model.meshes.size(),
+                     Bounds{glm::vec3(std::numeric_limits<float>::max()),
+                            glm::vec3(-std::numeric_limits<float>::max())});
+  staging.buffer_users =
+      std::make_unique<std::atomic<int>[]>(model.buffers.size());
+  for (size_t mesh_index = 0; mesh_index < model.meshes.size(); mesh_index++) {
+    auto &mesh = model.meshes[mesh_index];
+    meshes[mesh_index].reserve(mesh.primitives.size());
+    for (auto &prim : mesh.primitives) {
+      Staging::Primitive staged{};
+      staged.mesh = (int)mesh_index;
+      staged.first_vertex = staging.vertex_count;
+      // we only copy what we need
+      for (size_t i = 0; i < staged.attributes.size(); i++) {
+        auto &attribute = vertex_attributes[i];
+        staged.attributes[i] = -1;
+        auto it = prim.attributes.find(attribute.name);
+        if (it == prim.attributes.end() || it->second < 0) {
+          continue;
+        }
+        auto &accessor = model.accessors[it->second];
+        if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
+          std::cout << "warn: only support float vertex attribute"
+                    << std::endl;
+          continue;
+        }
+        if (accessor.type != attribute.type) {
+          std::cout << "warn: accessor type not surpport for attribute "
+                    << attribute.name << std::endl;
+          continue;
+        }
+        if (accessor.bufferView < 0) {
+          continue;
+        }
+        staged.attributes[i] = it->second;
+        staged.vertex_count =
+            std::max(staged.vertex_count, (uint32_t)accessor.count);
+      }
+
+      staged.indices = -1;
+      staged.index_count = staged.vertex_count;
+      if (prim.indices >= 0) {
+        auto &accessor = model.accessors[prim.indices];
+        switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        case TINYGLTF_COMPONENT_TYPE_INT:
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+          break;
+        default:
+          throw std::runtime_error("invalid type for indices");
+        }
+        // without index data the vertices are drawn in order
+        if (accessor.bufferView >= 0 && accessor.count > 0) {
+          staged.indices = prim.indices;
+          staged.index_count = (uint32_t)accessor.count;
+        }
+      }
+
+      for (size_t i = 0; i <= staged.attributes.size(); i++) {
+        auto accessor_index =
+            i < staged.attributes.size() ? staged.attributes[i] : staged.indices;
+        if (accessor_index < 0) {
+          continue;
+        }
+        auto &accessor = model.accessors[accessor_index];
+        auto buffer = model.bufferViews[accessor.bufferView].buffer;
+        if (std::find(staged.buffers.begin(), staged.buffers.end(), buffer) ==
+            staged.buffers.end()) {
+          staged.buffers.push_back(buffer);
+          staging.buffer_users[buffer]++;
+        }
+      }
+
+      // the default material is appended after the file's ones
+      staged.material =
+          prim.material < 0 ? (int)model.materials.size() : prim.material;
+      // the index range is assigned in load_batches, once the pages of the
+      // materials are known
+      meshes[mesh_index].push_back(
+          Primitive{0, staged.index_count, staged.material});
+      staging.vertex_count += staged.vertex_count;
+      staging.primitives.push_back(std::move(staged));
+    }
+  }
+}
+
+void Gltf::convert_primitives(Staging &staging,
+                              Mesh::Vertex *vertices,
+                              uint32_t *indices) {
+  MICROPROFILE_SCOPEI("Gltf", "ConvertPrimitives", 0x8ab17d);
+  auto &model = *staging.model;
+  auto source_of = [&](int accessor_index, size_t *stride) {
     auto &accessor = model.accessors[accessor_index];
     auto &buffer_view = model.bufferViews[accessor.bufferView];
-    auto stride = accessor.ByteStride(buffer_view);
-    auto offset = accessor.byteOffset + buffer_view.byteOffset;
+    *stride = accessor.ByteStride(buffer_view);
     auto &buffer = model.buffers[buffer_view.buffer];
-    return [offset, &buffer, stride](int index) {
-      return &buffer.data[offset + index * stride];
-    };
+    return &buffer.data[accessor.byteOffset + buffer_view.byteOffset];
   };
 
-  for (auto &mesh : model.meshes) {
-    std::vector<Primitive> primitives;
-    primitives.reserve(mesh.primitives.size());
-    for (auto &prim : mesh.primitives) {
-      std::vector<Mesh::Vertex> vertices;
-      {
-        auto copy_attr =
-            [&](const std::string &attr_name, auto func, int accessor_type) {
-              auto it = prim.attributes.find(attr_name);
-              if (it == prim.attributes.end()) {
-                return;
-              }
-              auto accessor_index = it->second;
-              if (accessor_index < 0) {
-                return;
-              }
-              auto accessor = model.accessors[accessor_index];
-              if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
-                std::cout << "warn: only support float vertex attribute"
-                          << std::endl;
-                return;
-              }
-              if (accessor.type != accessor_type) {
-                std::cout << "warn: accessor type not surpport for attribute "
-                          << attr_name << std::endl;
-                return;
-              }
-              if (accessor.count > vertices.size()) {
-                vertices.resize(accessor.count);
-              }
-              auto reader = make_reader(accessor_index);
-              for (int i = 0; i < accessor.count; i++) {
-                func(vertices[i], reader(i));
-              }
-            };
-
-#define COPY_ATTR(name, field, type)                                           \
-  copy_attr(                                                                   \
-      name,                                                                    \
-      [](Mesh::Vertex &vert, uint8_t *data) {                                  \
-        std::memcpy(&vert.field, data, sizeof(Mesh::Vertex::field));           \
-      },                                                                       \
-      type)
-
-        // for all attributes see
-        // https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md
-        // we only copy what we need
-        COPY_ATTR("POSITION", position, TINYGLTF_TYPE_VEC3);
-        COPY_ATTR("NORMAL", normal, TINYGLTF_TYPE_VEC3);
-        COPY_ATTR("TANGENT", tangent, TINYGLTF_TYPE_VEC4);
-        COPY_ATTR("TEXCOORD_0", uv0, TINYGLTF_TYPE_VEC2);
-        COPY_ATTR("TEXCOORD_1", uv1, TINYGLTF_TYPE_VEC2);
-        COPY_ATTR("COLOR_0", color, TINYGLTF_TYPE_VEC4);
-
-#undef COPY_ATTR
+  auto &jobs = JobSystem::instance();
+  auto primitive_count = staging.primitives.size();
+  jobs.parallel_for(0, primitive_count, 1, [&](size_t first, size_t last) {
+    for (size_t p = first; p < last; p++) {
+      auto &prim = staging.primitives[p];
+      constexpr size_t attribute_count = std::size(vertex_attributes);
+      const unsigned char *sources[attribute_count]{};
+      size_t strides[attribute_count]{};
+      size_t counts[attribute_count]{};
+      for (size_t i = 0; i < attribute_count; i++) {
+        if (prim.attributes[i] >= 0) {
+          sources[i] = source_of(prim.attributes[i], &strides[i]);
+          counts[i] = model.accessors[prim.attributes[i]].count;
+        }
       }
 
-      std::vector<uint32_t> indices;
-      {
-        auto accessor_index = prim.indices;
-        if (accessor_index >= 0) {
-          auto &accessor = model.accessors[accessor_index];
-          auto reader = make_reader(accessor_index);
-          indices.resize(accessor.count);
-          for (int i = 0; i < accessor.count; i++) {
-            switch (accessor.componentType) {
-            case TINYGLTF_COMPONENT_TYPE_BYTE:
-              indices[i] = *(int8_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-              indices[i] = *(uint8_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_SHORT:
-              indices[i] = *(int16_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-              indices[i] = *(uint16_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_INT:
-              indices[i] = *(int32_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-              indices[i] = *(uint32_t *)reader(i);
-              break;
-            default:
-              throw std::runtime_error("invalid type for indices");
-            }
+      // whole vertices are written in order and nothing is read back, the
+      // mapping may be uncached
+      auto vertex_material = (uint32_t)prim.material;
+      Bounds bounds{glm::vec3(std::numeric_limits<float>::max()),
+                    glm::vec3(-std::numeric_limits<float>::max())};
+      auto *vertex_out = vertices + prim.first_vertex;
+      for (uint32_t v = 0; v < prim.vertex_count; v++) {
+        Mesh::Vertex vertex{};
+        for (size_t i = 0; i < attribute_count; i++) {
+          if (v < counts[i]) {
+            std::memcpy((unsigned char *)&vertex + vertex_attributes[i].offset,
+                        sources[i] + v * strides[i],
+                        vertex_attributes[i].size);
           }
         }
+        vertex.material = vertex_material;
+        bounds.min = glm::min(bounds.min, vertex.position);
+        bounds.max = glm::max(bounds.max, vertex.position);
+        vertex_out[v] = vertex;
       }
+      prim.bounds = bounds;
 
-      if (indices.empty()) {
-        primitives.emplace_back(Primitive{
-            std::make_unique<Mesh>(
-                vertices.data(), (uint32_t)vertices.size(), nullptr, 0),
-            prim.material});
+      // the texture coordinate density of the whole primitive, from the
+      // areas of its triangles in mesh and texture space
+      double area = 0.0, uv_area = 0.0;
+      uint32_t triangle[3];
+      auto measure = [&](uint32_t i, uint32_t index) {
+        triangle[i % 3] = index;
+        if (i % 3 != 2 || sources[0] == nullptr || sources[3] == nullptr) {
+          return;
+        }
+        glm::vec3 p[3];
+        glm::vec2 uv[3];
+        for (int k = 0; k < 3; k++) {
+          if (triangle[k] >= counts[0] || triangle[k] >= counts[3]) {
+            return;
+          }
+          std::memcpy(&p[k], sources[0] + triangle[k] * strides[0], 12);
+          std::memcpy(&uv[k], sources[3] + triangle[k] * strides[3], 8);
+        }
+        area += glm::length(glm::cross(p[1] - p[0], p[2] - p[0]));
+        auto du = uv[1] - uv[0], dv = uv[2] - uv[0];
+        uv_area += std::abs(du.x * dv.y - du.y * dv.x);
+      };
+
+      // indices are absolute in the shared vertex buffer
+      auto *index_out = indices + prim.first_index;
+      auto copy_indices = [&](auto type) {
+        size_t stride;
+        auto *source = source_of(prim.indices, &stride);
+        for (uint32_t i = 0; i < prim.index_count; i++) {
+          decltype(type) index;
+          std::memcpy(&index, source + i * stride, sizeof(index));
+          index_out[i] = (uint32_t)index + prim.first_vertex;
+          measure(i, (uint32_t)index);
+        }
+      };
+      if (prim.indices < 0) {
+        for (uint32_t i = 0; i < prim.index_count; i++) {
+          index_out[i] = i + prim.first_vertex;
+          measure(i, i);
+        }
       } else {
-        primitives.emplace_back(
-            Primitive{std::make_unique<Mesh>(vertices.data(),
-                                             (uint32_t)vertices.size(),
-                                             indices.data(),
-                                             (uint32_t)indices.size()),
-                      prim.material});
+        switch (model.accessors[prim.indices].componentType) {
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+          copy_indices(int8_t{});
+          break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+          copy_indices(uint8_t{});
+          break;
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+          copy_indices(int16_t{});
+          break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+          copy_indices(uint16_t{});
+          break;
+        case TINYGLTF_COMPONENT_TYPE_INT:
+          copy_indices(int32_t{});
+          break;
+        default:
+          copy_indices(uint32_t{});
+          break;
+        }
+      }
+      prim.uv_density = area > 0.0 ? (float)std::sqrt(uv_area / area) : 0.0f;
+
+      for (auto buffer : prim.buffers) {
+        if (--staging.buffer_users[buffer] == 0) {
+          model.buffers[buffer].data = {};
+        }
       }
+      staging.converted++;
     }
+  });
+}
 
-    meshes.emplace_back(std::move(primitives));
+namespace {
+glm::mat4 node_local_transform(const Gltf::Node &node) {
+  if (node.has_matrix) {
+    return node.matrix;
   }
+  auto ident = glm::identity<glm::mat4>();
+  return glm::translate(ident, node.translation) *
+         glm::mat4_cast(node.rotation) * glm::scale(ident, node.scale);
 }
 
-namespace {
-glm::mat4 gltf_node_local_transform(const tinygltf::Node &node) {
-  glm::vec3 translation{0, 0, 0};
-  glm::quat rotation{1, 0, 0, 0};
-  glm::vec3 scale{1, 1, 1};
-  if (node.translation.size() == 3) {
-    translation = glm::vec3(static_cast<float>(node.translation[0]),
-                            static_cast<float>(node.translation[1]),
-                            static_cast<float>(node.translation[2]));
+// Components of a float or normalized integer accessor as floats
+std::vector<float> read_accessor_floats(tinygltf::Model &model,
+                                        int accessor_index) {
+  auto &accessor = model.accessors[accessor_index];
+  if (accessor.bufferView < 0) {
+    return {};
   }
+  auto &buffer_view = model.bufferViews[accessor.bufferView];
+  auto &buffer = model.buffers[buffer_view.buffer];
+  auto stride = accessor.ByteStride(buffer_view);
+  auto components = tinygltf::GetNumComponentsInType(accessor.type);
+  auto data = &buffer.data[accessor.byteOffset + buffer_view.byteOffset];
 
-  if (node.rotation.size() == 4) {
-    // GLTF quaternion component order [x, y, z, w]
-    // glm quaternion constructor component order [w, x, y, z]
-    rotation = glm::quat(static_cast<float>(node.rotation[3]),
-                         static_cast<float>(node.rotation[0]),
-                         static_cast<float>(node.rotation[1]),
-                         static_cast<float>(node.rotation[2]));
+  std::vector<float> values;
+  values.reserve(accessor.count * components);
+  for (size_t i = 0; i < accessor.count; i++) {
+    auto element = data + i * stride;
+    for (int c = 0; c < components; c++) {
+      switch (accessor.componentType) {
+      case TINYGLTF_COMPONENT_TYPE_FLOAT:
+        values.push_back(((float *)element)[c]);
+        break;
+      case TINYGLTF_COMPONENT_TYPE_BYTE:
+        values.push_back(std::max(((int8_t *)element)[c] / 127.0f, -1.0f));
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        values.push_back(((uint8_t *)element)[c] / 255.0f);
+        break;
+      case TINYGLTF_COMPONENT_TYPE_SHORT:
+        values.push_back(std::max(((int16_t *)element)[c] / 32767.0f, -1.0f));
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        values.push_back(((uint16_t *)element)[c] / 65535.0f);
+        break;
+      default:
+        return {};
+      }
+    }
   }
+  return values;
+}
 
-  if (node.scale.size() == 3) {
-    scale = glm::vec3(static_cast<float>(node.scale[0]),
-                      static_cast<float>(node.scale[1]),
-                      static_cast<float>(node.scale[2]));
+glm::vec4 sample_channel(const Gltf::AnimationChannel &channel, float time) {
+  auto &times = channel.times;
+  auto &values = channel.values;
+  bool cubic = channel.interpolation == Gltf::AnimationChannel::CubicSpline;
+  // cubic splines keep the value in the middle of each triplet
+  auto value = [&](size_t key) { return cubic ? values[key * 3 + 1] : values[key]; };
+  if (time <= times.front()) {
+    return value(0);
+  }
+  if (time >= times.back()) {
+    return value(times.size() - 1);
   }
 
-  auto ident = glm::identity<glm::mat4>();
-  auto local_to_parent = glm::translate(ident, translation) *
-                         glm::mat4_cast(rotation) * glm::scale(ident, scale);
+  auto next = (size_t)(std::upper_bound(times.begin(), times.end(), time) -
+                       times.begin());
+  auto prev = next - 1;
+  auto delta = times[next] - times[prev];
+  auto t = (time - times[prev]) / delta;
+  bool rotation = channel.path == Gltf::AnimationChannel::Rotation;
 
-  if (node.matrix.size() == 16) {
-    auto matrix = glm::identity<glm::mat4>();
-    for (int i = 0; i < 4; i++) {
-      for (int j = 0; j < 4; j++) {
-        local_to_parent[i][j] = static_cast<float>(node.matrix[i * 4 + j]);
-      }
+  switch (channel.interpolation) {
+  case Gltf::AnimationChannel::Step:
+    return value(prev);
+  case Gltf::AnimationChannel::CubicSpline: {
+    auto t2 = t * t;
+    auto t3 = t2 * t;
+    auto result = (2 * t3 - 3 * t2 + 1) * values[prev * 3 + 1] +
+                  (t3 - 2 * t2 + t) * delta * values[prev * 3 + 2] +
+                  (-2 * t3 + 3 * t2) * values[next * 3 + 1] +
+                  (t3 - t2) * delta * values[next * 3];
+    return rotation ? glm::normalize(result) : result;
+  }
+  default:
+    if (rotation) {
+      auto a = values[prev], b = values[next];
+      auto q = glm::slerp(glm::quat(a.w, a.x, a.y, a.z),
+                          glm::quat(b.w, b.x, b.y, b.z),
+                          t);
+      return glm::vec4(q.x, q.y, q.z, q.w);
     }
+    return glm::mix(values[prev], values[next], t);
   }
-
-  return local_to_parent;
 }
 } // namespace
 
@@ -303,23 +1084,227 @@ void Gltf::load_scene(tinygltf::Model &model) {
   auto scene_index = model.defaultScene < 0 ? 0 : model.defaultScene;
   auto &scene = model.scenes[scene_index];
 
+  _node_map.assign(model.nodes.size(), -1);
   for (int node_index : scene.nodes) {
-    load_node(model, node_index, glm::identity<glm::mat4>());
+    load_node(model, node_index, -1);
   }
+  _moved_nodes.assign(nodes.size(), false);
 }
 
-void Gltf::load_node(tinygltf::Model &model,
-                     int node_index,
-                     const glm::mat4 &parent_to_world) {
+void Gltf::load_node(tinygltf::Model &model, int node_index, int parent) {
   auto &node = model.nodes[node_index];
-  auto local_to_parent = gltf_node_local_transform(node);
-  auto local_to_world = parent_to_world * local_to_parent;
-
+  Node flat{parent,
+            -1,
+            glm::vec3(0, 0, 0),
+            glm::quat(1, 0, 0, 0),
+            glm::vec3(1, 1, 1),
+            node.matrix.size() == 16,
+            glm::identity<glm::mat4>(),
+            glm::identity<glm::mat4>(),
+            false};
+  if (node.translation.size() == 3) {
+    flat.translation = glm::vec3(static_cast<float>(node.translation[0]),
+                                 static_cast<float>(node.translation[1]),
+                                 static_cast<float>(node.translation[2]));
+  }
+  if (node.rotation.size() == 4) {
+    // GLTF quaternion component order [x, y, z, w]
+    // glm quaternion constructor component order [w, x, y, z]
+    flat.rotation = glm::quat(static_cast<float>(node.rotation[3]),
+                              static_cast<float>(node.rotation[0]),
+                              static_cast<float>(node.rotation[1]),
+                              static_cast<float>(node.rotation[2]));
+  }
+  if (node.scale.size() == 3) {
+    flat.scale = glm::vec3(static_cast<float>(node.scale[0]),
+                           static_cast<float>(node.scale[1]),
+                           static_cast<float>(node.scale[2]));
+  }
+  if (flat.has_matrix) {
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 4; j++) {
+        flat.matrix[i][j] = static_cast<float>(node.matrix[i * 4 + j]);
+      }
+    }
+  }
+  flat.world = node_local_transform(flat);
+  if (parent >= 0) {
+    flat.world = nodes[parent].world * flat.world;
+  }
   if (node.mesh >= 0) {
-    draws.push_back(MeshDraw{node.mesh, local_to_world});
+    flat.draw = (int)draws.size();
+    draws.push_back(MeshDraw{node.mesh, flat.world});
   }
 
+  auto index = (int)nodes.size();
+  _node_map[node_index] = index;
+  nodes.push_back(flat);
   for (auto child_index : node.children) {
-    load_node(model, child_index, local_to_world);
+    load_node(model, child_index, index);
+  }
+}
+
+void Gltf::load_animations(tinygltf::Model &model) {
+  MICROPROFILE_SCOPEI("Gltf", "LoadAnimations", 0x8ab17d);
+  for (auto &animation : model.animations) {
+    Animation flat{animation.name, 0.0f, {}};
+    for (auto &channel : animation.channels) {
+      if (channel.target_node < 0 ||
+          _node_map[channel.target_node] < 0 ||
+          nodes[_node_map[channel.target_node]].has_matrix) {
+        continue;
+      }
+      AnimationChannel::Path path;
+      if (channel.target_path == "translation") {
+        path = AnimationChannel::Translation;
+      } else if (channel.target_path == "rotation") {
+        path = AnimationChannel::Rotation;
+      } else if (channel.target_path == "scale") {
+        path = AnimationChannel::Scale;
+      } else {
+        // morph target weights are not supported
+        continue;
+      }
+      auto &sampler = animation.samplers[channel.sampler];
+      auto interpolation = AnimationChannel::Linear;
+      if (sampler.interpolation == "STEP") {
+        interpolation = AnimationChannel::Step;
+      } else if (sampler.interpolation == "CUBICSPLINE") {
+        interpolation = AnimationChannel::CubicSpline;
+      }
+
+      auto times = read_accessor_floats(model, sampler.input);
+      auto output = read_accessor_floats(model, sampler.output);
+      size_t components = path == AnimationChannel::Rotation ? 4 : 3;
+      size_t per_key =
+          interpolation == AnimationChannel::CubicSpline ? 3 : 1;
+      if (times.empty() ||
+          output.size() != times.size() * components * per_key) {
+        std::cout << "warn: skipping animation channel of " << animation.name
+                  << std::endl;
+        continue;
+      }
+      std::vector<glm::vec4> values(output.size() / components);
+      for (size_t i = 0; i < values.size(); i++) {
+        std::memcpy(&values[i], &output[i * components],
+                    components * sizeof(float));
+      }
+      flat.duration = std::max(flat.duration, times.back());
+      flat.channels.push_back(AnimationChannel{_node_map[channel.target_node],
+                                               path,
+                                               interpolation,
+                                               std::move(times),
+                                               std::move(values)});
+    }
+    animations.push_back(std::move(flat));
+  }
+}
+
+void Gltf::animate(uint32_t animation, float time) {
+  MICROPROFILE_SCOPEI("Gltf", "Animate", 0x8ab17d);
+  auto &anim = animations[animation];
+  if (anim.duration > 0.0f) {
+    time = std::fmod(time, anim.duration);
   }
+  for (auto &channel : anim.channels) {
+    auto value = sample_channel(channel, time);
+    auto &node = nodes[channel.node];
+    switch (channel.path) {
+    case AnimationChannel::Translation:
+      node.translation = glm::vec3(value);
+      break;
+    case AnimationChannel::Rotation:
+      node.rotation = glm::quat(value.w, value.x, value.y, value.z);
+      break;
+    case AnimationChannel::Scale:
+      node.scale = glm::vec3(value);
+      break;
+    }
+    node.dirty = true;
+  }
+}
+
+const std::vector<uint32_t> &Gltf::update_transforms() {
+  MICROPROFILE_SCOPEI("Gltf", "UpdateTransforms", 0x8ab17d);
+  _moved_draws.clear();
+  for (size_t i = 0; i < nodes.size(); i++) {
+    auto &node = nodes[i];
+    // parents come first, so their world matrix is already final
+    bool moved = node.dirty || (node.parent >= 0 && _moved_nodes[node.parent]);
+    _moved_nodes[i] = moved;
+    if (!moved) {
+      continue;
+    }
+    node.dirty = false;
+    node.world = node_local_transform(node);
+    if (node.parent >= 0) {
+      node.world = nodes[node.parent].world * node.world;
+    }
+    if (node.draw >= 0) {
+      set_transform(node.draw, node.world);
+      _moved_draws.push_back(node.draw);
+    }
+  }
+  return _moved_draws;
+}
+
+GltfLoader::GltfLoader(const fs::path &name, SceneCache *cache) :
+    _scene(new Gltf()), _staging(std::make_unique<Gltf::Staging>()) {
+  _staging->cache = cache;
+  _worker = JobSystem::instance().submit(
+      [this, name] { _scene->load_model(name, *_staging); });
+}
+
+GltfLoader::~GltfLoader() {
+  try {
+    JobSystem::instance().wait(_worker);
+  } catch (...) {
+    // nobody is left to report it to
+  }
+}
+
+bool GltfLoader::staged() const {
+  return _worker.done();
+}
+
+bool GltfLoader::idle() const {
+  return _worker.done() && _staging->conversion.done();
+}
+
+bool GltfLoader::step(float budget_ms) {
+  if (!staged()) {
+    return false;
+  }
+  if (_worker.valid()) {
+    // rethrows parse errors on the calling thread
+    auto worker = std::move(_worker);
+    JobSystem::instance().wait(worker);
+  }
+  auto start = std::chrono::steady_clock::now();
+  do {
+    // the last step would block on the conversion, try again next frame
+    if (_staging->converting()) {
+      return false;
+    }
+    if (!_scene->upload_next(*_staging)) {
+      return true;
+    }
+  } while (std::chrono::duration<float, std::milli>(
+               std::chrono::steady_clock::now() - start)
+               .count() < budget_ms);
+  return false;
+}
+
+float GltfLoader::progress() const {
+  if (!staged() || _staging->total() == 0) {
+    return 0.5f * _staging->progress;
+  }
+  // every converted primitive counts as much as an uploaded texture
+  auto done = _staging->uploaded + _staging->converted.load();
+  auto total = _staging->total() + _staging->primitives.size();
+  return 0.5f + 0.5f * (float)done / (float)total;
+}
+
+std::unique_ptr<Gltf> GltfLoader::take() {
+  return std::move(_scene);
 }
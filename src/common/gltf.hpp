@@ -1,34 +1,109 @@
 #pragma once
 
 #include "data.hpp"
+#include "jobs.hpp"
 #include "mesh.hpp"
 #include "texture.hpp"
+#include <glm/gtc/quaternion.hpp>
 #include <memory>
 
 namespace tinygltf {
 class Model;
 }
 
+class SceneCache;
+
 class Gltf {
 public:
-  Gltf(const fs::path &name);
+  // Pages are uploaded with the levels up to this size only, the finer
+  // ones are streamed in through set_page_level
+  static constexpr int MIP_TAIL_SIZE = 64;
+  // Textures already resident in `cache` are shared instead of uploaded
+  Gltf(const fs::path &name, SceneCache *cache = nullptr);
 
+  // Index range of one primitive in `geometry`, indices are absolute
   struct Primitive {
-    std::unique_ptr<Mesh> mesh;
+    uint32_t first_index;
+    uint32_t index_count;
     int material;
   };
 
+  // The primitives of a mesh whose base colors live in the same page. They
+  // are stored next to each other and drawn as one index range.
+  struct Batch {
+    int page; // -1 if none of the materials has a base color texture
+    uint32_t first_index;
+    uint32_t index_count;
+    // texture coordinate units per mesh unit, the largest of the
+    // primitives, 0 without texture coordinates
+    float uv_density;
+  };
+
+  // One instance in instance_buffer, seven RGBA32F texels
+  struct InstanceData {
+    glm::mat4 model;
+    glm::mat3x4 normal; // transpose(inverse(mat3(model))), padded columns
+  };
+
+  // The draws of one mesh, consecutive in the instance buffer
+  struct InstanceGroup {
+    int mesh;
+    uint32_t first_instance;
+    uint32_t instance_count;
+  };
+
   struct MeshDraw {
     int index;
     glm::mat4 transform;
   };
 
+  // Axis aligned box, empty meshes have min > max
+  struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+  };
+
+  // A scene node, parents are stored before their children
+  struct Node {
+    int parent; // -1 for roots
+    int draw;   // -1 without a mesh
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+    // set for nodes given as a matrix, which animations cannot target
+    bool has_matrix;
+    glm::mat4 matrix;
+    glm::mat4 world;
+    bool dirty;
+  };
+
+  struct AnimationChannel {
+    enum Path { Translation, Rotation, Scale };
+    enum Interpolation { Linear, Step, CubicSpline };
+    int node;
+    Path path;
+    Interpolation interpolation;
+    std::vector<float> times;
+    // xyz or a quaternion as xyzw, cubic splines store in-tangent, value and
+    // out-tangent per key
+    std::vector<glm::vec4> values;
+  };
+
+  struct Animation {
+    std::string name;
+    float duration;
+    std::vector<AnimationChannel> channels;
+  };
+
   struct Material {
     enum Mode { Opaque, Blend };
     Mode mode;
     bool double_sided;
     glm::vec4 base_color_factor;
     int base_color;
+    // location of the base color texture in `pages`, page is -1 without one
+    int base_color_page;
+    int base_color_layer;
     float metallic_factor;
     float roughness_factor;
     int metallic_roughness;
@@ -40,21 +115,136 @@ public:
     glm::vec3 emission_factor;
   };
 
+  // The mip chains of a page's layers, kept on the CPU so that levels can
+  // be dropped from the GL texture and uploaded again later
+  struct PageSource {
+    int width;
+    int height;
+    GLenum type;
+    TextureSettings settings;
+    std::vector<int> textures; // file texture of each layer
+    // every level of a layer, finest first, starting at level_offsets
+    std::vector<std::vector<unsigned char>> layers;
+    std::vector<size_t> level_offsets;
+    int tail_level;     // the coarse levels that always stay resident
+    int resident_level; // finest level in `pages`
+
+    int levels() const;
+    // of the GL texture holding `level` and the coarser ones
+    size_t bytes(int level) const;
+  };
+
+  // One material in material_buffer, two RGBA32F texels
+  struct MaterialData {
+    glm::vec4 base_color_factor;
+    glm::vec4 base_color; // layer, has texture
+  };
+
+  // All primitives share one vertex and index buffer
+  std::unique_ptr<Mesh> geometry;
   std::vector<std::vector<Primitive>> meshes;
+  std::vector<std::vector<Batch>> batches; // per mesh
+  std::vector<Bounds> mesh_bounds;          // in mesh space
   std::vector<MeshDraw> draws;
-  std::vector<std::unique_ptr<Texture2D>> textures;
+  std::vector<Node> nodes;
+  std::vector<Animation> animations;
+  std::vector<InstanceGroup> instance_groups;
+  std::vector<uint32_t> draw_instances; // instance of each draw
+  // (instance group, batch) pairs sorted by page, so that a pass binds each
+  // page once
+  std::vector<std::pair<uint32_t, uint32_t>> draw_order;
+  // base color textures are only in `pages`, their entry here is null
+  std::vector<std::shared_ptr<Texture2D>> textures;
+  std::vector<size_t> texture_bytes;
+  std::vector<std::unique_ptr<Texture2DArray>> pages;
+  std::vector<PageSource> page_sources;
   std::vector<std::unique_ptr<Material>> materials;
+  // MaterialData of every material, indexed by Mesh::Vertex::material
+  std::unique_ptr<Buffer> material_buffer;
+  std::unique_ptr<TextureBuffer> material_texture;
+  // InstanceData of every instance, fetched with the group's
+  // first_instance + gl_InstanceID
+  std::unique_ptr<Buffer> instance_buffer;
+  std::unique_ptr<TextureBuffer> instance_texture;
+
+  // Samples an animation at `time` seconds, wrapping around its duration,
+  // and marks the nodes it moves
+  void animate(uint32_t animation, float time);
+  // Recomputes the world matrices below dirty nodes in one pass over
+  // `nodes` and returns the draws that moved
+  const std::vector<uint32_t> &update_transforms();
+
+  // World space box around a draw at its current transform
+  Bounds draw_bounds(uint32_t draw) const;
+
+  // Recreates a page with `level` as its finest mip level, uploaded from
+  // page_sources along with the coarser ones
+  void set_page_level(int page, int level);
+
+  // Moves a draw, the instance buffer is updated by the next flush
+  void set_transform(uint32_t draw, const glm::mat4 &transform);
+  // Uploads the instances changed since the last flush as one range
+  void flush_transforms();
+
+  // GPU memory of the meshes and the resident levels of the pages,
+  // textures are accounted in texture_bytes
+  size_t gpu_bytes() const;
+  size_t cpu_bytes() const;
 
 private:
-  void load_model(const fs::path &name);
+  friend class GltfLoader;
+  // CPU side data waiting for upload
+  struct Staging;
+
+  Gltf() = default;
+
+  void load_model(const fs::path &name, Staging &staging);
+  bool upload_next(Staging &staging);
   void load_materials(tinygltf::Model &model);
-  void load_textures(tinygltf::Model &model);
-  void load_meshes(tinygltf::Model &model);
+  void load_textures(tinygltf::Model &model, Staging &staging);
+  void load_meshes(tinygltf::Model &model, Staging &staging);
+  // Writes the vertices and indices of every primitive straight into the
+  // mapped geometry, on the job system
+  static void convert_primitives(Staging &staging,
+                                 Mesh::Vertex *vertices,
+                                 uint32_t *indices);
+  void load_pages(Staging &staging);
+  void load_batches(Staging &staging);
   void load_scene(tinygltf::Model &model);
-  void load_node(tinygltf::Model &model,
-                 int node_index,
-                 const glm::mat4 &parent_to_world);
+  void load_node(tinygltf::Model &model, int node_index, int parent);
+  void load_animations(tinygltf::Model &model);
 
   uint32_t _white_tex_index;
   uint32_t _default_normal_tex_index;
-};
\ No newline at end of file
+  size_t _gpu_bytes = 0;
+  std::vector<InstanceData> _instances;
+  // range of _instances not yet in instance_buffer
+  size_t _dirty_begin = 0, _dirty_end = 0;
+  // flat index of each file node, -1 outside the default scene
+  std::vector<int> _node_map;
+  std::vector<uint32_t> _moved_draws;
+  std::vector<bool> _moved_nodes;
+};
+
+// Loads a scene without blocking the render loop. The file is parsed and
+// converted as a job on the shared JobSystem, then step() creates the GL
+// objects on the calling thread a few at a time.
+class GltfLoader {
+public:
+  GltfLoader(const fs::path &name, SceneCache *cache = nullptr);
+  ~GltfLoader();
+
+  // Uploads staged data for about budget_ms, returns true once the scene
+  // is complete. Loading errors are rethrown from here.
+  bool step(float budget_ms);
+  float progress() const;
+  bool staged() const;
+  // No job of the loader is running, so destroying it will not block
+  bool idle() const;
+  std::unique_ptr<Gltf> take();
+
+private:
+  std::unique_ptr<Gltf> _scene;
+  std::unique_ptr<Gltf::Staging> _staging;
+  JobSystem::Handle _worker;
+};
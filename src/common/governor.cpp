@@ -0,0 +1,67 @@
+#include "governor.hpp"
+#include <algorithm>
+#include <iostream>
+
+QualityGovernor::QualityGovernor(int levels, int level, size_t history):
+    _levels(levels), _level(std::clamp(level, 0, levels - 1)), _decisions(history) {}
+
+bool QualityGovernor::update(uint64_t frame, float gpu_ms) {
+    if (gpu_ms <= 0.0f) {
+        return false;
+    }
+    if (_cooldown > 0) {
+        _cooldown--;
+        return false;
+    }
+    _smoothed_ms = _smoothed_ms == 0.0f ? gpu_ms : _smoothed_ms + settings.smoothing * (gpu_ms - _smoothed_ms);
+
+    if (_smoothed_ms > settings.target_ms) {
+        _below = 0;
+        if (_level > 0) {
+            change(frame, _level - 1);
+            return true;
+        }
+        return false;
+    }
+    if (_smoothed_ms < settings.target_ms * settings.headroom) {
+        _below++;
+    } else {
+        // between headroom and target is the band where nothing changes
+        _below = 0;
+    }
+    if (_below >= settings.raise_after && _level + 1 < _levels) {
+        change(frame, _level + 1);
+        return true;
+    }
+    return false;
+}
+
+void QualityGovernor::set_level(int level) {
+    _level       = std::clamp(level, 0, _levels - 1);
+    _smoothed_ms = 0.0f;
+    _cooldown    = settings.cooldown;
+    _below       = 0;
+}
+
+int QualityGovernor::level() const {
+    return _level;
+}
+
+int QualityGovernor::levels() const {
+    return _levels;
+}
+
+float QualityGovernor::smoothed_ms() const {
+    return _smoothed_ms;
+}
+
+const FixSizeQueue<QualityGovernor::Decision> & QualityGovernor::decisions() const {
+    return _decisions;
+}
+
+void QualityGovernor::change(uint64_t frame, int level) {
+    std::cout << "quality: level " << _level << " -> " << level << " at frame " << frame << " (gpu " << _smoothed_ms
+              << " ms, target " << settings.target_ms << " ms)" << std::endl;
+    _decisions.push(Decision { frame, _level, level, _smoothed_ms });
+    set_level(level);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "utils.hpp"
+#include <cstdint>
+
+// Steers a discrete quality level toward a GPU frame time budget. Frame
+// times are smoothed, the level drops as soon as the average exceeds the
+// budget and rises only after a run of frames well below it. Every change
+// is followed by a cooldown so that the new level is measured before the
+// next decision.
+class QualityGovernor {
+public:
+    struct Settings {
+        float target_ms = 16.0f;
+        // quality is only raised below target_ms * headroom
+        float headroom = 0.75f;
+        // frames ignored after a change, their queries predate it
+        int cooldown = 15;
+        // consecutive frames below the headroom before raising quality
+        int raise_after = 60;
+        // weight of the newest frame in the moving average
+        float smoothing = 0.1f;
+    };
+
+    struct Decision {
+        uint64_t frame;
+        int      from, to;
+        float    gpu_ms;
+    };
+
+    QualityGovernor(int levels, int level, size_t history = 16);
+
+    // Feeds the GPU time of a frame, returns true if the level changed
+    bool update(uint64_t frame, float gpu_ms);
+    // Overrides the level and restarts the measurement
+    void set_level(int level);
+
+    int                            level() const;
+    int                            levels() const;
+    float                          smoothed_ms() const;
+    const FixSizeQueue<Decision> & decisions() const;
+
+    Settings settings;
+
+private:
+    void change(uint64_t frame, int level);
+
+    int                    _levels;
+    int                    _level;
+    float                  _smoothed_ms = 0.0f;
+    int                    _cooldown    = 0;
+    int                    _below       = 0;
+    FixSizeQueue<Decision> _decisions;
+};
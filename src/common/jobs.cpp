@@ -0,0 +1,254 @@
+#include "jobs.hpp"
+#include "profile.h"
+#include <algorithm>
+#include <string>
+
+struct JobSystem::Task {
+    std::function<void()> job;
+    // unfinished dependencies, plus one while submit() is registering them
+    std::atomic<int>                   blockers { 1 };
+    std::mutex                         mutex;
+    std::vector<std::shared_ptr<Task>> dependents;
+    std::exception_ptr                 error;
+    std::atomic<bool>                  done { false };
+};
+
+namespace {
+    // the pool and index of the worker running on this thread
+    thread_local const JobSystem * current_system = nullptr;
+    thread_local int               current_worker = -1;
+
+    // progress of one parallel_for, shared with the helper jobs which may
+    // only start after the loop has returned
+    struct Loop {
+        const std::function<void(size_t, size_t)> * body;
+        size_t                                      begin, end, grain, chunks;
+        std::atomic<size_t>                         next { 0 };
+        std::atomic<size_t>                         finished { 0 };
+        std::mutex                                  mutex;
+        std::exception_ptr                          error;
+
+        // Runs chunks until none are left. `body` is only touched for a
+        // claimed chunk, which keeps the caller waiting.
+        void work() {
+            for (size_t chunk = next++; chunk < chunks; chunk = next++) {
+                size_t first = begin + chunk * grain;
+                try {
+                    (*body)(first, std::min(first + grain, end));
+                } catch (...) {
+                    std::lock_guard lock(mutex);
+                    if (! error) error = std::current_exception();
+                }
+                finished++;
+            }
+        }
+    };
+} // namespace
+
+JobSystem::Handle::Handle(std::shared_ptr<Task> task):
+    _task(std::move(task)) {}
+
+bool JobSystem::Handle::done() const {
+    return _task == nullptr || _task->done.load(std::memory_order_acquire);
+}
+
+bool JobSystem::Handle::valid() const {
+    return _task != nullptr;
+}
+
+JobSystem::JobSystem(uint32_t worker_count) {
+    if (worker_count == 0) {
+        worker_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+    for (uint32_t i = 0; i < worker_count; i++) {
+        _workers.push_back(std::make_unique<Worker>());
+    }
+    // started once every deque exists, workers steal from all of them
+    for (uint32_t i = 0; i < worker_count; i++) {
+        _workers[i]->thread = std::thread(&JobSystem::worker_loop, this, (int) i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard lock(_sleep_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for (auto & worker : _workers) {
+        worker->thread.join();
+    }
+}
+
+JobSystem & JobSystem::instance() {
+    static JobSystem system;
+    return system;
+}
+
+JobSystem::Handle JobSystem::submit(std::function<void()> job, const std::vector<Handle> & dependencies) {
+    auto task = std::make_shared<Task>();
+    task->job = std::move(job);
+    for (auto & dependency : dependencies) {
+        if (dependency._task == nullptr) continue;
+        std::lock_guard lock(dependency._task->mutex);
+        if (! dependency._task->done.load(std::memory_order_relaxed)) {
+            task->blockers++;
+            dependency._task->dependents.push_back(task);
+        } else if (dependency._task->error && ! task->error) {
+            task->error = dependency._task->error;
+        }
+    }
+    if (--task->blockers == 0) {
+        schedule(task);
+    }
+    return Handle(task);
+}
+
+void JobSystem::wait(const Handle & handle) {
+    if (handle._task == nullptr) return;
+    auto & task = *handle._task;
+    while (! task.done.load(std::memory_order_acquire)) {
+        int worker = current_system == this ? current_worker : -1;
+        if (auto other = take(worker)) {
+            run(*other);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+void JobSystem::parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> & body) {
+    if (end <= begin) return;
+    grain        = std::max<size_t>(grain, 1);
+    auto loop    = std::make_shared<Loop>();
+    loop->body   = &body;
+    loop->begin  = begin;
+    loop->end    = end;
+    loop->grain  = grain;
+    loop->chunks = (end - begin + grain - 1) / grain;
+
+    // one helper per worker at most, each runs chunks until none are left
+    size_t helpers = std::min<size_t>(loop->chunks - 1, _workers.size());
+    for (size_t i = 0; i < helpers; i++) {
+        submit([loop] { loop->work(); });
+    }
+    loop->work();
+    while (loop->finished.load() < loop->chunks) {
+        std::this_thread::yield();
+    }
+    if (loop->error) {
+        std::rethrow_exception(loop->error);
+    }
+}
+
+uint32_t JobSystem::worker_count() const {
+    return (uint32_t) _workers.size();
+}
+
+JobSystem::Stats JobSystem::stats() const {
+    return Stats { _executed.load(), _stolen.load() };
+}
+
+void JobSystem::schedule(std::shared_ptr<Task> task) {
+    if (current_system == this) {
+        auto & worker = *_workers[current_worker];
+        std::lock_guard lock(worker.mutex);
+        worker.jobs.push_back(std::move(task));
+    } else {
+        std::lock_guard lock(_injected_mutex);
+        _injected.push_back(std::move(task));
+    }
+    {
+        std::lock_guard lock(_sleep_mutex);
+        _queued++;
+    }
+    _wake.notify_one();
+}
+
+void JobSystem::run(Task & task) {
+    if (! task.error) {
+        try {
+            task.job();
+        } catch (...) {
+            task.error = std::current_exception();
+        }
+    }
+    task.job = nullptr;
+    _executed++;
+
+    std::vector<std::shared_ptr<Task>> dependents;
+    {
+        std::lock_guard lock(task.mutex);
+        task.done.store(true, std::memory_order_release);
+        dependents.swap(task.dependents);
+    }
+    for (auto & dependent : dependents) {
+        if (task.error) {
+            std::lock_guard lock(dependent->mutex);
+            if (! dependent->error) dependent->error = task.error;
+        }
+        if (--dependent->blockers == 0) {
+            schedule(std::move(dependent));
+        }
+    }
+}
+
+std::shared_ptr<JobSystem::Task> JobSystem::take(int worker) {
+    std::shared_ptr<Task> task;
+    if (worker >= 0) {
+        auto & own = *_workers[worker];
+        std::lock_guard lock(own.mutex);
+        if (! own.jobs.empty()) {
+            task = std::move(own.jobs.back());
+            own.jobs.pop_back();
+        }
+    }
+    if (task == nullptr) {
+        std::lock_guard lock(_injected_mutex);
+        if (! _injected.empty()) {
+            task = std::move(_injected.front());
+            _injected.pop_front();
+        }
+    }
+    if (task == nullptr) {
+        // start at a different victim each time to spread the contention
+        auto first = _next_victim++;
+        for (size_t i = 0; i < _workers.size() && task == nullptr; i++) {
+            auto victim = (first + i) % _workers.size();
+            if ((int) victim == worker) continue;
+            auto &          other = *_workers[victim];
+            std::lock_guard lock(other.mutex);
+            if (! other.jobs.empty()) {
+                task = std::move(other.jobs.front());
+                other.jobs.pop_front();
+                _stolen++;
+            }
+        }
+    }
+    if (task != nullptr) {
+        _queued--;
+    }
+    return task;
+}
+
+void JobSystem::worker_loop(int worker) {
+    current_system = this;
+    current_worker = worker;
+    auto name      = "Job" + std::to_string(worker);
+    MicroProfileOnThreadCreate(name.c_str());
+    while (true) {
+        if (auto task = take(worker)) {
+            run(*task);
+            continue;
+        }
+        std::unique_lock lock(_sleep_mutex);
+        _wake.wait(lock, [this] { return _queued.load() > 0 || _quit; });
+        if (_quit && _queued.load() == 0) {
+            break;
+        }
+    }
+    MicroProfileOnThreadExit();
+}
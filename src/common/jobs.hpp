@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A pool of worker threads running small jobs. Every worker owns a deque:
+// jobs submitted from a worker are pushed to the back of its deque and taken
+// from there newest first, idle workers steal the oldest jobs from the front
+// of the others' deques. Jobs submitted from other threads go through a
+// shared queue.
+class JobSystem {
+    struct Task;
+
+public:
+    // Refers to a submitted job, default constructed handles count as done
+    class Handle {
+    public:
+        Handle() = default;
+
+        // Polls without blocking, e.g. once per frame from the render loop
+        bool done() const;
+        bool valid() const;
+
+    private:
+        friend class JobSystem;
+        explicit Handle(std::shared_ptr<Task> task);
+
+        std::shared_ptr<Task> _task;
+    };
+
+    struct Stats {
+        uint64_t executed; // jobs run to completion
+        uint64_t stolen;   // jobs taken from another worker's deque
+    };
+
+    // 0 workers picks one less than the hardware threads, leaving one for
+    // the render loop
+    explicit JobSystem(uint32_t worker_count = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem &)             = delete;
+    JobSystem & operator=(const JobSystem &) = delete;
+
+    // The process wide pool, created on first use
+    static JobSystem & instance();
+
+    // Runs `job` once all of `dependencies` have finished. A job whose
+    // dependency threw is skipped and reports the same exception.
+    Handle submit(std::function<void()> job, const std::vector<Handle> & dependencies = {});
+
+    // Blocks until the job has finished and rethrows its exception. The
+    // calling thread runs queued jobs meanwhile, so jobs may wait on each
+    // other without starving the pool.
+    void wait(const Handle & handle);
+
+    // Calls body(first, last) for chunks of at least `grain` items covering
+    // [begin, end) and returns once all of them are done. The calling thread
+    // works on the chunks too, but never picks up unrelated jobs, which keeps
+    // it safe to use from the render loop. The first exception is rethrown.
+    void parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> & body);
+
+    uint32_t worker_count() const;
+    Stats    stats() const;
+
+private:
+    struct Worker {
+        std::mutex                        mutex;
+        std::deque<std::shared_ptr<Task>> jobs;
+        std::thread                       thread;
+    };
+
+    void                  schedule(std::shared_ptr<Task> task);
+    void                  run(Task & task);
+    std::shared_ptr<Task> take(int worker);
+    void                  worker_loop(int worker);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::mutex                           _injected_mutex;
+    std::deque<std::shared_ptr<Task>>    _injected;
+    std::atomic<uint32_t>                _next_victim { 0 };
+
+    // sleeping workers wait for _queued, which only grows under _sleep_mutex.
+    // Signed, a job may be taken before its push has been counted.
+    std::mutex              _sleep_mutex;
+    std::condition_variable _wake;
+    std::atomic<int64_t>    _queued { 0 };
+    bool                    _quit = false;
+
+    std::atomic<uint64_t> _executed { 0 };
+    std::atomic<uint64_t> _stolen { 0 };
+};
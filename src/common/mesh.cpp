@@ -1,4 +1,6 @@
 #include "mesh.hpp"
+#include "render_state.hpp"
+#include <stdexcept>
 
 Buffer::Buffer(void *data, size_t size, GLenum type) {
   glGenBuffers(1, &_id);
@@ -46,9 +48,24 @@ Mesh::Mesh(const Vertex *vertices,
     _index_buffer = nullptr;
   }
 
+  init_attributes();
+}
+
+Mesh::Mesh(uint32_t vertex_count, uint32_t index_count) {
+  _vao = std::make_unique<VertexArray>();
+  _vertex_buffer =
+      std::make_unique<Buffer>(nullptr, sizeof(Vertex) * vertex_count);
+  _index_buffer =
+      std::make_unique<Buffer>(nullptr, sizeof(uint32_t) * index_count);
+  _vertex_count = vertex_count;
+  _draw_count = index_count;
+  init_attributes();
+}
+
+void Mesh::init_attributes() {
   glBindVertexArray(_vao->get());
   glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer->get());
-  if (indices != nullptr) {
+  if (_index_buffer != nullptr) {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_buffer->get());
   }
 
@@ -69,6 +86,51 @@ Mesh::Mesh(const Vertex *vertices,
   ENABLE_LOCATION(5, 4, color);
 
 #undef ENABLE_LOCATION
+
+  glVertexAttribIPointer(6,
+                         1,
+                         GL_UNSIGNED_INT,
+                         sizeof(Vertex),
+                         (void *)offsetof(Vertex, material));
+  glEnableVertexAttribArray(6);
+}
+
+void Mesh::map(Vertex **vertices, uint32_t **indices) {
+  // the copy target leaves the element binding of the bound VAO alone, and
+  // empty ranges cannot be mapped
+  auto access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+  *vertices = nullptr;
+  *indices = nullptr;
+  if (_vertex_count > 0) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _vertex_buffer->get());
+    *vertices = (Vertex *)glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, 0, sizeof(Vertex) * _vertex_count, access);
+  }
+  if (_draw_count > 0) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _index_buffer->get());
+    *indices = (uint32_t *)glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, 0, sizeof(uint32_t) * _draw_count, access);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  if ((_vertex_count > 0 && *vertices == nullptr) ||
+      (_draw_count > 0 && *indices == nullptr)) {
+    unmap();
+    throw std::runtime_error("failed to map mesh buffers");
+  }
+}
+
+bool Mesh::unmap() {
+  bool intact = true;
+  GLint mapped = GL_FALSE;
+  for (auto *buffer : {_vertex_buffer.get(), _index_buffer.get()}) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->get());
+    glGetBufferParameteriv(GL_COPY_WRITE_BUFFER, GL_BUFFER_MAPPED, &mapped);
+    if (mapped) {
+      intact &= glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE;
+    }
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return intact;
 }
 
 void Mesh::draw() {
@@ -76,6 +138,30 @@ void Mesh::draw() {
     return;
   }
   glBindVertexArray(_vao->get());
+  submit();
+}
+
+void Mesh::draw(RenderState &state) {
+  if (_draw_count == 0) {
+    return;
+  }
+  state.bind_vertex_array(_vao->get());
+  submit();
+}
+
+void Mesh::draw_instanced(RenderState &state,
+                          uint32_t first_index,
+                          uint32_t index_count,
+                          uint32_t instance_count) {
+  state.bind_vertex_array(_vao->get());
+  glDrawElementsInstanced(GL_TRIANGLES,
+                          (GLsizei)index_count,
+                          GL_UNSIGNED_INT,
+                          (const void *)(sizeof(uint32_t) * first_index),
+                          (GLsizei)instance_count);
+}
+
+void Mesh::submit() {
   if (_index_buffer != nullptr) {
     glDrawElements(
         GL_TRIANGLES, (GLsizei)_draw_count, GL_UNSIGNED_INT, nullptr);
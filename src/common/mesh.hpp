@@ -5,6 +5,8 @@
 #include <memory>
 #include <vector>
 
+class RenderState;
+
 class Buffer {
 public:
   Buffer(void *data, size_t size, GLenum type = GL_STATIC_DRAW);
@@ -36,17 +38,37 @@ public:
     glm::vec2 uv0;      // location 3
     glm::vec2 uv1;      // location 4
     glm::vec4 color;    // location 5
+    uint32_t material;  // location 6, integer attribute
   };
 
   Mesh(const Vertex *vertices,
        uint32_t vertex_count,
        const uint32_t *indices,
        uint32_t index_count);
+  // Reserves room for the vertices and indices, which are then written
+  // through map()
+  Mesh(uint32_t vertex_count, uint32_t index_count);
+
+  // Maps both buffers write-only. The pointers may be written from any
+  // thread, but the mesh must not be drawn until unmap() on the GL thread.
+  void map(Vertex **vertices, uint32_t **indices);
+  // Returns false if the contents were lost while mapped
+  bool unmap();
 
   void draw();
+  void draw(RenderState &state);
+  // Draws `instance_count` instances of an index range
+  void draw_instanced(RenderState &state,
+                      uint32_t first_index,
+                      uint32_t index_count,
+                      uint32_t instance_count);
 
 private:
+  void init_attributes();
+  void submit();
+
   uint32_t _draw_count = 0;
+  uint32_t _vertex_count = 0;
 
   std::unique_ptr<VertexArray> _vao{};
   std::unique_ptr<Buffer> _vertex_buffer{};
@@ -0,0 +1,193 @@
+#include "occlusion.hpp"
+#include "profile.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    glm::vec4 corner_of(const glm::vec3 & min, const glm::vec3 & max, int index, const glm::mat4 & view_projection) {
+        glm::vec3 corner((index & 1) ? max.x : min.x, (index & 2) ? max.y : min.y, (index & 4) ? max.z : min.z);
+        return view_projection * glm::vec4(corner, 1.0f);
+    }
+} // namespace
+
+OcclusionCuller::OcclusionCuller(uint32_t ring_size):
+    _ring(ring_size) {
+    for (auto & slot : _ring) {
+        glGenBuffers(1, &slot.pbo);
+    }
+}
+
+OcclusionCuller::~OcclusionCuller() {
+    for (auto & slot : _ring) {
+        if (slot.fence != nullptr) {
+            glDeleteSync(slot.fence);
+        }
+        glDeleteBuffers(1, &slot.pbo);
+    }
+}
+
+bool OcclusionCuller::read(int width, int height, int texel_size, glm::ivec2 viewport, const glm::mat4 & view_projection) {
+    Slot * slot = nullptr;
+    for (auto & s : _ring) {
+        if (s.fence == nullptr) {
+            slot = &s;
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        return false;
+    }
+
+    size_t size = (size_t) width * height * sizeof(float);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    if (slot->capacity < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot->capacity = size;
+    }
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->fence           = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->width           = width;
+    slot->height          = height;
+    slot->texel_size      = texel_size;
+    slot->viewport        = viewport;
+    slot->view_projection = view_projection;
+    slot->generation      = _generation;
+    _in_flight.push_back(slot);
+    return true;
+}
+
+void OcclusionCuller::update() {
+    // only the newest finished readback matters, older ones are dropped
+    Slot * newest = nullptr;
+    while (! _in_flight.empty()) {
+        Slot * slot   = _in_flight.front();
+        GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        _in_flight.pop_front();
+        glDeleteSync(slot->fence);
+        slot->fence = nullptr;
+        if (slot->generation == _generation) {
+            newest = slot;
+        }
+    }
+    if (newest != nullptr) {
+        retire(*newest);
+    }
+}
+
+void OcclusionCuller::reset() {
+    _generation++;
+    _levels.clear();
+}
+
+bool OcclusionCuller::ready() const {
+    return ! _levels.empty();
+}
+
+void OcclusionCuller::retire(Slot & slot) {
+    MICROPROFILE_SCOPEI("Occlusion", "Retire", 0x5e6472);
+    size_t size = (size_t) slot.width * slot.height * sizeof(float);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    auto * mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (mapped != nullptr) {
+        _levels.resize(1);
+        auto & level      = _levels[0];
+        level.width       = slot.width;
+        level.height      = slot.height;
+        level.texel_size  = slot.texel_size;
+        level.depth.resize((size_t) slot.width * slot.height);
+        std::memcpy(level.depth.data(), mapped, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        _viewport        = slot.viewport;
+        _view_projection = slot.view_projection;
+        build_levels();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void OcclusionCuller::build_levels() {
+    while (_levels.back().width > 1 || _levels.back().height > 1) {
+        auto & source = _levels.back();
+        Level  level { (source.width + 1) / 2, (source.height + 1) / 2, source.texel_size * 2, {} };
+        level.depth.resize((size_t) level.width * level.height);
+        for (int y = 0; y < level.height; y++) {
+            int y0 = 2 * y, y1 = std::min(2 * y + 1, source.height - 1);
+            for (int x = 0; x < level.width; x++) {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, source.width - 1);
+                level.depth[(size_t) y * level.width + x] = std::max(
+                    std::max(source.depth[(size_t) y0 * source.width + x0], source.depth[(size_t) y0 * source.width + x1]),
+                    std::max(source.depth[(size_t) y1 * source.width + x0], source.depth[(size_t) y1 * source.width + x1]));
+            }
+        }
+        _levels.push_back(std::move(level));
+    }
+}
+
+OcclusionCuller::Result OcclusionCuller::test(const glm::vec3 & min, const glm::vec3 & max, const glm::mat4 & view_projection) const {
+    if (min.x > max.x) {
+        // an empty mesh, nothing would be drawn
+        return Result::Outside;
+    }
+
+    // outside if all corners are beyond the same clip plane
+    int outside[6] {};
+    for (int i = 0; i < 8; i++) {
+        auto clip = corner_of(min, max, i, view_projection);
+        outside[0] += clip.x < -clip.w;
+        outside[1] += clip.x > clip.w;
+        outside[2] += clip.y < -clip.w;
+        outside[3] += clip.y > clip.w;
+        outside[4] += clip.z < -clip.w;
+        outside[5] += clip.z > clip.w;
+    }
+    for (int count : outside) {
+        if (count == 8) {
+            return Result::Outside;
+        }
+    }
+    if (_levels.empty()) {
+        return Result::Visible;
+    }
+
+    // the window space rectangle and nearest depth in the pyramid's view
+    glm::vec2 lower(1.0f), upper(-1.0f);
+    float     nearest = 1.0f;
+    for (int i = 0; i < 8; i++) {
+        auto clip = corner_of(min, max, i, _view_projection);
+        if (clip.w <= 1e-5f) {
+            return Result::Visible;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        lower         = i == 0 ? glm::vec2(ndc) : glm::min(lower, glm::vec2(ndc));
+        upper         = i == 0 ? glm::vec2(ndc) : glm::max(upper, glm::vec2(ndc));
+        nearest       = std::min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+    if (lower.x < -1.0f || lower.y < -1.0f || upper.x > 1.0f || upper.y > 1.0f) {
+        // partly outside the old view, which has no depth there
+        return Result::Visible;
+    }
+    auto first = glm::ivec2((lower * 0.5f + 0.5f) * glm::vec2(_viewport));
+    auto last  = glm::min(glm::ivec2((upper * 0.5f + 0.5f) * glm::vec2(_viewport)), _viewport - 1);
+
+    // the finest level where the rectangle spans at most 2x2 texels
+    size_t index = 0;
+    while (index + 1 < _levels.size() && (last.x / _levels[index].texel_size - first.x / _levels[index].texel_size > 1 || last.y / _levels[index].texel_size - first.y / _levels[index].texel_size > 1)) {
+        index++;
+    }
+    auto & level = _levels[index];
+    auto   from  = glm::min(first / level.texel_size, glm::ivec2(level.width, level.height) - 1);
+    auto   to    = glm::min(last / level.texel_size, glm::ivec2(level.width, level.height) - 1);
+    float  depth = 0.0f;
+    for (int y = from.y; y <= to.y; y++) {
+        for (int x = from.x; x <= to.x; x++) {
+            depth = std::max(depth, level.depth[(size_t) y * level.width + x]);
+        }
+    }
+    return nearest > depth ? Result::Occluded : Result::Visible;
+}
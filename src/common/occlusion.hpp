@@ -0,0 +1,71 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <deque>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Tests bounding boxes against a depth pyramid of an earlier frame. The
+// coarse levels are built on the GPU and read back through a ring of pixel
+// buffer objects, so the result is used a few frames late without stalling;
+// the remaining levels are reduced on the CPU.
+class OcclusionCuller {
+public:
+    enum class Result { Visible, Outside, Occluded };
+
+    explicit OcclusionCuller(uint32_t ring_size = 3);
+    ~OcclusionCuller();
+
+    OcclusionCuller(const OcclusionCuller &)             = delete;
+    OcclusionCuller & operator=(const OcclusionCuller &) = delete;
+
+    // Queues a readback of the bound framebuffer, a max depth level of
+    // `width` x `height` texels each covering `texel_size` pixels of a
+    // `viewport` sized view rendered with `view_projection`. Returns false
+    // if every slot of the ring is still in flight.
+    bool read(int width, int height, int texel_size, glm::ivec2 viewport, const glm::mat4 & view_projection);
+
+    // Picks up finished readbacks without waiting, the newest one replaces
+    // the pyramid. Must be called on the GL thread.
+    void update();
+
+    // Forgets the pyramid and the readbacks in flight, e.g. when the scene
+    // changes and the old depth no longer describes it
+    void reset();
+
+    bool ready() const;
+
+    // Frustum test against `view_projection`, then the occlusion test
+    // against the pyramid in the view it was rendered from. Boxes that
+    // cross its near plane or leave that view are visible.
+    Result test(const glm::vec3 & min, const glm::vec3 & max, const glm::mat4 & view_projection) const;
+
+private:
+    struct Slot {
+        GLuint     pbo {};
+        GLsync     fence {};
+        size_t     capacity {};
+        int        width {}, height {};
+        int        texel_size {};
+        glm::ivec2 viewport {};
+        glm::mat4  view_projection {};
+        uint64_t   generation {};
+    };
+
+    struct Level {
+        int                width, height;
+        int                texel_size; // in pixels
+        std::vector<float> depth;
+    };
+
+    void retire(Slot & slot);
+    void build_levels();
+
+    std::vector<Slot>  _ring;
+    std::deque<Slot *> _in_flight;
+    uint64_t           _generation = 0;
+
+    std::vector<Level> _levels;
+    glm::ivec2         _viewport {};
+    glm::mat4          _view_projection {};
+};
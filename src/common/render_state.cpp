@@ -0,0 +1,183 @@
+#include "render_state.hpp"
+#include "profile.h"
+#include <cassert>
+#include <cstring>
+#include <glm/gtc/type_ptr.hpp>
+
+void RenderState::begin_frame() {
+    _last_frame = _current;
+    _current    = {};
+    MICROPROFILE_COUNTER_SET("gl/issued", (int64_t) _last_frame.issued);
+    MICROPROFILE_COUNTER_SET("gl/skipped", (int64_t) _last_frame.skipped);
+    invalidate();
+}
+
+void RenderState::invalidate() {
+    _program     = UNKNOWN;
+    _framebuffer = UNKNOWN;
+    _vao         = UNKNOWN;
+    _active_unit = UNKNOWN;
+    _textures.fill({ GL_NONE, UNKNOWN });
+    _uniform_buffers.fill({ UNKNOWN, 0, 0 });
+    _current_uniforms = nullptr;
+}
+
+void RenderState::use_program(GLuint program) {
+    if (_program == program) {
+        _current.skipped++;
+        return;
+    }
+    glUseProgram(program);
+    _current.issued++;
+    _program          = program;
+    _current_uniforms = &_uniforms[program];
+}
+
+void RenderState::bind_framebuffer(GLuint framebuffer) {
+    if (_framebuffer == framebuffer) {
+        _current.skipped++;
+        return;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    _current.issued++;
+    _framebuffer = framebuffer;
+}
+
+void RenderState::bind_vertex_array(GLuint vao) {
+    if (_vao == vao) {
+        _current.skipped++;
+        return;
+    }
+    glBindVertexArray(vao);
+    _current.issued++;
+    _vao = vao;
+}
+
+void RenderState::bind_texture(GLuint unit, GLenum target, GLuint texture) {
+    auto & bound = _textures[unit];
+    if (bound.first == target && bound.second == texture) {
+        // the glActiveTexture in front of it is saved as well
+        _current.skipped += 2;
+        return;
+    }
+    if (_active_unit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        _current.issued++;
+        _active_unit = unit;
+    } else {
+        _current.skipped++;
+    }
+    glBindTexture(target, texture);
+    _current.issued++;
+    // binding another target leaves the previous one bound too, which is
+    // only a problem if a sampler of that type reads the unit
+    bound = { target, texture };
+}
+
+void RenderState::bind_uniform_buffer(GLuint binding, GLuint buffer) {
+    BufferRange range { buffer, 0, 0 };
+    if (_uniform_buffers[binding] == range) {
+        _current.skipped++;
+        return;
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    _current.issued++;
+    _uniform_buffers[binding] = range;
+}
+
+void RenderState::bind_uniform_buffer_range(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    BufferRange range { buffer, offset, size };
+    if (_uniform_buffers[binding] == range) {
+        _current.skipped++;
+        return;
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+    _current.issued++;
+    _uniform_buffers[binding] = range;
+}
+
+GLint RenderState::uniform_location(const char * name) {
+    return find_uniform(name).location;
+}
+
+RenderState::Uniform & RenderState::find_uniform(const char * name) {
+    assert(_current_uniforms != nullptr && "bind the program with use_program");
+    auto & uniforms = _current_uniforms->uniforms;
+    auto   it       = uniforms.find(std::string_view(name));
+    if (it != uniforms.end()) {
+        _current.skipped++;
+        return it->second;
+    }
+    Uniform uniform;
+    uniform.location = glGetUniformLocation(_program, name);
+    _current.issued++;
+    return uniforms.emplace(name, uniform).first->second;
+}
+
+RenderState::Uniform * RenderState::changed_uniform(const char * name, const void * value, size_t size) {
+    auto & uniform = find_uniform(name);
+    if (uniform.location < 0 || (uniform.size == size && std::memcmp(uniform.value.data(), value, size) == 0)) {
+        _current.skipped++;
+        return nullptr;
+    }
+    std::memcpy(uniform.value.data(), value, size);
+    uniform.size = size;
+    _current.issued++;
+    return &uniform;
+}
+
+void RenderState::set_uniform(const char * name, int value) {
+    if (auto uniform = changed_uniform(name, &value, sizeof(value))) {
+        glUniform1i(uniform->location, value);
+    }
+}
+
+void RenderState::set_uniform(const char * name, float value) {
+    if (auto uniform = changed_uniform(name, &value, sizeof(value))) {
+        glUniform1f(uniform->location, value);
+    }
+}
+
+void RenderState::set_uniform(const char * name, const glm::vec2 & value) {
+    if (auto uniform = changed_uniform(name, &value, sizeof(value))) {
+        glUniform2fv(uniform->location, 1, glm::value_ptr(value));
+    }
+}
+
+void RenderState::set_uniform(const char * name, const glm::vec3 & value) {
+    if (auto uniform = changed_uniform(name, &value, sizeof(value))) {
+        glUniform3fv(uniform->location, 1, glm::value_ptr(value));
+    }
+}
+
+void RenderState::set_uniform(const char * name, const glm::vec4 & value) {
+    if (auto uniform = changed_uniform(name, &value, sizeof(value))) {
+        glUniform4fv(uniform->location, 1, glm::value_ptr(value));
+    }
+}
+
+void RenderState::set_uniform(const char * name, const glm::mat4 & value) {
+    if (auto uniform = changed_uniform(name, &value, sizeof(value))) {
+        glUniformMatrix4fv(uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+}
+
+void RenderState::set_uniform_block(const char * name, GLuint binding) {
+    assert(_current_uniforms != nullptr && "bind the program with use_program");
+    auto & blocks = _current_uniforms->blocks;
+    auto   it     = blocks.find(std::string_view(name));
+    if (it != blocks.end() && it->second == binding) {
+        _current.skipped += 2;
+        return;
+    }
+    auto index = glGetUniformBlockIndex(_program, name);
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(_program, index, binding);
+    }
+    _current.issued += 2;
+    blocks[name] = binding;
+}
+
+RenderState::Stats RenderState::last_frame() const {
+    return _last_frame;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+// Shadows the GL bindings and uniform values set through it and drops calls
+// that would not change anything. GL code that bypasses the tracker (ImGui,
+// resource creation, ...) must be followed by invalidate(); begin_frame()
+// does so once per frame.
+//
+// Uniform values are remembered per program name, which assumes programs
+// outlive the tracker.
+class RenderState {
+public:
+    struct Stats {
+        uint64_t issued;  // GL calls that reached the driver
+        uint64_t skipped; // calls dropped as redundant or answered from cache
+    };
+
+    static constexpr GLuint TEXTURE_UNITS           = 16;
+    static constexpr GLuint UNIFORM_BUFFER_BINDINGS = 8;
+
+    void begin_frame();
+    void invalidate();
+
+    void use_program(GLuint program);
+    void bind_framebuffer(GLuint framebuffer);
+    void bind_vertex_array(GLuint vao);
+    void bind_texture(GLuint unit, GLenum target, GLuint texture);
+    void bind_uniform_buffer(GLuint binding, GLuint buffer);
+    // Binds `size` bytes from `offset` on, e.g. a region of a RingBuffer
+    void bind_uniform_buffer_range(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    // Of the program bound through use_program(), -1 for uniforms that were
+    // optimized out
+    GLint uniform_location(const char * name);
+
+    void set_uniform(const char * name, int value);
+    void set_uniform(const char * name, float value);
+    void set_uniform(const char * name, const glm::vec2 & value);
+    void set_uniform(const char * name, const glm::vec3 & value);
+    void set_uniform(const char * name, const glm::vec4 & value);
+    void set_uniform(const char * name, const glm::mat4 & value);
+    // Points a uniform block of the current program at a buffer binding
+    void set_uniform_block(const char * name, GLuint binding);
+
+    // Counters of the previous complete frame
+    Stats last_frame() const;
+
+private:
+    struct Uniform {
+        GLint                                  location = -1;
+        size_t                                 size     = 0; // of the last uploaded value, 0 before the first
+        std::array<uint8_t, sizeof(glm::mat4)> value {};
+    };
+
+    struct ProgramUniforms {
+        std::map<std::string, Uniform, std::less<>> uniforms;
+        std::map<std::string, GLuint, std::less<>>  blocks;
+    };
+
+    Uniform & find_uniform(const char * name);
+    // Returns the uniform if `value` differs from what was last uploaded
+    Uniform * changed_uniform(const char * name, const void * value, size_t size);
+
+    // a whole buffer is bound with size 0
+    struct BufferRange {
+        GLuint     buffer;
+        GLintptr   offset;
+        GLsizeiptr size;
+
+        bool operator==(const BufferRange &) const = default;
+    };
+
+    static constexpr GLuint UNKNOWN = ~0u;
+
+    GLuint                                               _program     = UNKNOWN;
+    GLuint                                               _framebuffer = UNKNOWN;
+    GLuint                                               _vao         = UNKNOWN;
+    GLuint                                               _active_unit = UNKNOWN;
+    std::array<std::pair<GLenum, GLuint>, TEXTURE_UNITS> _textures {};
+    std::array<BufferRange, UNIFORM_BUFFER_BINDINGS>     _uniform_buffers {};
+
+    ProgramUniforms *                           _current_uniforms {};
+    std::unordered_map<GLuint, ProgramUniforms> _uniforms;
+
+    Stats _current {};
+    Stats _last_frame {};
+};
@@ -18,6 +18,16 @@ void Renderer::init_blit() {
 }
 
 void Renderer::blit(Texture2D *tex, IMaterial *material) {
+  prepare_blit(tex, material);
+  _full_screen_triangle->draw();
+}
+
+void Renderer::blit(RenderState &state, Texture2D *tex, IMaterial *material) {
+  prepare_blit(tex, material);
+  _full_screen_triangle->draw(state);
+}
+
+void Renderer::prepare_blit(Texture2D *tex, IMaterial *material) {
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT);
   glDisable(GL_DEPTH_TEST);
@@ -27,5 +37,4 @@ void Renderer::blit(Texture2D *tex, IMaterial *material) {
   material->projection = glm::identity<glm::mat4>();
   material->main_tex = tex;
   material->use();
-  _full_screen_triangle->draw();
 }
@@ -4,6 +4,8 @@
 #include "texture.hpp"
 #include <glm/glm.hpp>
 
+class RenderState;
+
 class IMaterial {
 public:
   glm::mat4 model{};
@@ -19,9 +21,12 @@ public:
   Renderer();
 
   void blit(Texture2D *tex, IMaterial *material);
+  // Same as above, binding the vertex array through `state`
+  void blit(RenderState &state, Texture2D *tex, IMaterial *material);
 
 private:
   void init_blit();
+  void prepare_blit(Texture2D *tex, IMaterial *material);
 
   std::unique_ptr<Mesh> _full_screen_triangle;
 };
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "ring_buffer.hpp"
+#include "profile.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+RingBuffer::RingBuffer(GLenum target, size_t region_size, uint32_t regions, bool persistent):
+    _target(target), _persistent(persistent && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)), _fences(std::max(regions, 1u), nullptr) {
+    GLint alignment = 16;
+    if (target == GL_UNIFORM_BUFFER) {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    }
+    _alignment   = (size_t) std::max(alignment, 16);
+    _region_size = (region_size + _alignment - 1) / _alignment * _alignment;
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(_target, _buffer);
+    if (_persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(_target, _region_size * _fences.size(), nullptr, flags);
+        _mapped = (uint8_t *) glMapBufferRange(_target, 0, _region_size * _fences.size(), flags);
+        if (_mapped == nullptr) {
+            // storage is immutable, start over with a plain buffer
+            glBindBuffer(_target, 0);
+            glDeleteBuffers(1, &_buffer);
+            glGenBuffers(1, &_buffer);
+            glBindBuffer(_target, _buffer);
+            _persistent = false;
+        }
+    }
+    if (! _persistent) {
+        glBufferData(_target, _region_size, nullptr, GL_STREAM_DRAW);
+        _staging.resize(_region_size);
+    }
+    glBindBuffer(_target, 0);
+}
+
+RingBuffer::~RingBuffer() {
+    for (auto fence : _fences) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+        }
+    }
+    if (_mapped != nullptr) {
+        glBindBuffer(_target, _buffer);
+        glUnmapBuffer(_target);
+        glBindBuffer(_target, 0);
+    }
+    glDeleteBuffers(1, &_buffer);
+}
+
+void RingBuffer::begin_frame() {
+    _offset  = 0;
+    _flushed = 0;
+    if (! _persistent) {
+        // the driver hands out fresh storage while the GPU reads the old one
+        glBindBuffer(_target, _buffer);
+        glBufferData(_target, _region_size, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(_target, 0);
+        return;
+    }
+    _region      = (_region + 1) % (uint32_t) _fences.size();
+    auto & fence = _fences[_region];
+    if (fence == nullptr) {
+        return;
+    }
+    MICROPROFILE_SCOPEI("RingBuffer", "Wait", 0xb5838d);
+    auto   start  = std::chrono::steady_clock::now();
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        _stats.waits++;
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        _stats.wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void RingBuffer::end_frame() {
+    _stats.peak_bytes = std::max(_stats.peak_bytes, _offset);
+    if (_persistent) {
+        _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    } else {
+        flush();
+    }
+}
+
+RingBuffer::Allocation RingBuffer::allocate(size_t size) {
+    if (_offset + size > _region_size) {
+        throw std::runtime_error("ring buffer region of " + std::to_string(_region_size) + " bytes is full");
+    }
+    Allocation allocation;
+    allocation.buffer = _buffer;
+    allocation.size   = (GLsizeiptr) size;
+    if (_persistent) {
+        allocation.offset = (GLintptr) (_region * _region_size + _offset);
+        allocation.data   = _mapped + allocation.offset;
+    } else {
+        allocation.offset = (GLintptr) _offset;
+        allocation.data   = _staging.data() + _offset;
+    }
+    _offset = std::min((_offset + size + _alignment - 1) / _alignment * _alignment, _region_size);
+    return allocation;
+}
+
+void RingBuffer::flush() {
+    // coherent mappings are seen by commands issued after the write
+    if (_persistent || _flushed == _offset) return;
+    glBindBuffer(_target, _buffer);
+    glBufferSubData(_target, (GLintptr) _flushed, (GLsizeiptr) (_offset - _flushed), _staging.data() + _flushed);
+    glBindBuffer(_target, 0);
+    _flushed = _offset;
+}
+
+bool RingBuffer::persistent() const {
+    return _persistent;
+}
+
+GLuint RingBuffer::get() const {
+    return _buffer;
+}
+
+RingBuffer::Stats RingBuffer::stats() const {
+    return _stats;
+}
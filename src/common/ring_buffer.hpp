@@ -0,0 +1,69 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+// Dynamic data written by the CPU every frame and read by the GPU in the
+// same frame, e.g. per-frame constants. The buffer is split into one region
+// per frame in flight, used round robin, and the fence placed by
+// end_frame() keeps a region from being rewritten before the GPU is done
+// with it. With GL 4.4 or ARB_buffer_storage the buffer is mapped once,
+// persistently and coherently, so allocations are written in place.
+// Otherwise they are staged in memory and uploaded by flush() into storage
+// that is orphaned at the start of every frame.
+class RingBuffer {
+public:
+    struct Allocation {
+        void *     data; // write only, until the end of the frame
+        GLuint     buffer;
+        GLintptr   offset;
+        GLsizeiptr size;
+    };
+
+    struct Stats {
+        uint64_t waits;      // frames that found their region still in use
+        double   wait_ms;    // blocked on fences in total
+        size_t   peak_bytes; // largest amount allocated in one frame
+    };
+
+    // `persistent` false forces the orphaning path
+    RingBuffer(GLenum target, size_t region_size, uint32_t regions = 3, bool persistent = true);
+    ~RingBuffer();
+
+    RingBuffer(const RingBuffer &)             = delete;
+    RingBuffer & operator=(const RingBuffer &) = delete;
+
+    // Moves to the next region, waiting for the GPU to release it
+    void begin_frame();
+    // Fences the region of the frame, after its last draw
+    void end_frame();
+
+    // Room for `size` bytes, aligned for binding as a range of the target.
+    // Throws when the region is full.
+    Allocation allocate(size_t size);
+    // Makes the allocations since the last flush visible to draws issued
+    // after it
+    void flush();
+
+    bool   persistent() const;
+    GLuint get() const;
+    Stats  stats() const;
+
+private:
+    GLenum    _target;
+    GLuint    _buffer {};
+    size_t    _region_size;
+    size_t    _alignment;
+    bool      _persistent;
+    uint8_t * _mapped {};
+
+    std::vector<GLsync> _fences; // per region
+    uint32_t            _region = 0;
+    size_t              _offset = 0;
+    // the orphaning path stages a frame's allocations here
+    std::vector<uint8_t> _staging;
+    size_t               _flushed = 0;
+
+    Stats _stats {};
+};
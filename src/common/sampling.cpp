@@ -0,0 +1,167 @@
+#include "sampling.hpp"
+#include "profile.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace {
+    float radical_inverse(uint32_t index, uint32_t base) {
+        float inverse = 1.0f / (float) base;
+        float scale   = inverse;
+        float result  = 0.0f;
+        while (index > 0) {
+            result += (float) (index % base) * scale;
+            index /= base;
+            scale *= inverse;
+        }
+        return result;
+    }
+
+    // second dimension of the Sobol sequence, the first is base 2 van der Corput
+    uint32_t sobol_second(uint32_t index) {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+            if (index & 1) {
+                result ^= v;
+            }
+        }
+        return result;
+    }
+
+    uint32_t reverse_bits(uint32_t bits) {
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+        bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+        bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+        bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+        return bits;
+    }
+
+    float to_unit(uint32_t bits) {
+        return std::min((float) bits * 0x1p-32f, 1.0f - std::numeric_limits<float>::epsilon());
+    }
+
+    float torus_distance2(glm::vec2 a, glm::vec2 b) {
+        auto d = glm::abs(a - b);
+        d      = glm::min(d, 1.0f - d);
+        return glm::dot(d, d);
+    }
+
+    // Mitchell's best candidate: each point is the candidate farthest from
+    // all previous ones, which gives a progressive blue noise set
+    std::vector<glm::vec2> best_candidate(size_t count, std::mt19937 & rng) {
+        constexpr int                         CANDIDATES = 16;
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::vector<glm::vec2>                points;
+        points.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            glm::vec2 best {};
+            float     best_distance = -1.0f;
+            for (int c = 0; c < CANDIDATES; c++) {
+                glm::vec2 candidate(uniform(rng), uniform(rng));
+                float     nearest = std::numeric_limits<float>::max();
+                for (auto & point : points) {
+                    nearest = std::min(nearest, torus_distance2(candidate, point));
+                }
+                if (nearest > best_distance) {
+                    best          = candidate;
+                    best_distance = nearest;
+                }
+            }
+            points.push_back(best);
+        }
+        return points;
+    }
+} // namespace
+
+const char * sample_pattern_name(SamplePattern pattern) {
+    switch (pattern) {
+    case SamplePattern::White:
+        return "White noise";
+    case SamplePattern::Halton:
+        return "Halton";
+    case SamplePattern::Sobol:
+        return "Sobol";
+    case SamplePattern::BlueNoise:
+        return "Blue noise";
+    }
+    return "";
+}
+
+std::vector<glm::vec2> generate_samples(SamplePattern pattern, size_t count, uint32_t seed) {
+    MICROPROFILE_SCOPEI("Sampling", "Generate", 0x457b9d);
+    std::mt19937                          rng(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<glm::vec2>                points;
+    points.reserve(count);
+    switch (pattern) {
+    case SamplePattern::White:
+        for (size_t i = 0; i < count; i++) {
+            auto x = uniform(rng);
+            points.emplace_back(x, uniform(rng));
+        }
+        break;
+    case SamplePattern::Halton: {
+        // skip the origin, and shift randomly so that seeds differ
+        glm::vec2 shift(uniform(rng), uniform(rng));
+        for (size_t i = 0; i < count; i++) {
+            glm::vec2 point(radical_inverse((uint32_t) i + 1, 2), radical_inverse((uint32_t) i + 1, 3));
+            points.push_back(glm::fract(point + shift));
+        }
+        break;
+    }
+    case SamplePattern::Sobol: {
+        // a random digital shift keeps the (0, 2)-sequence stratification
+        uint32_t scramble_x = rng(), scramble_y = rng();
+        for (size_t i = 0; i < count; i++) {
+            points.emplace_back(to_unit(reverse_bits((uint32_t) i) ^ scramble_x), to_unit(sobol_second((uint32_t) i) ^ scramble_y));
+        }
+        break;
+    }
+    case SamplePattern::BlueNoise:
+        points = best_candidate(count, rng);
+        break;
+    }
+    return points;
+}
+
+glm::vec2 sample_frame_offset(uint64_t frame) {
+    // 1 / plastic number and its square
+    const glm::dvec2 alpha(0.7548776662466927, 0.5698402909980532);
+    return glm::vec2(glm::fract(alpha * (double) frame));
+}
+
+SampleSet::SampleSet(SamplePattern pattern, size_t count):
+    _pattern(pattern), _size(std::max<size_t>(count, 1)) {
+    generate();
+}
+
+void SampleSet::require(SamplePattern pattern, size_t count) {
+    if (pattern == _pattern && count <= _size) {
+        return;
+    }
+    _pattern = pattern;
+    while (_size < count) {
+        _size *= 2;
+    }
+    generate();
+}
+
+SamplePattern SampleSet::pattern() const {
+    return _pattern;
+}
+
+size_t SampleSet::size() const {
+    return _size;
+}
+
+GLuint SampleSet::texture() const {
+    return _texture->get();
+}
+
+void SampleSet::generate() {
+    auto points = generate_samples(_pattern, _size);
+    _buffer     = std::make_unique<Buffer>(points.data(), points.size() * sizeof(glm::vec2));
+    _texture    = std::make_unique<TextureBuffer>(GL_RG32F, _buffer->get());
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "texture.hpp"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+// 2D sample sets in [0, 1)^2. Every pattern is progressive: any prefix is
+// itself well distributed, so shaders may use the first N points.
+enum class SamplePattern { White, Halton, Sobol, BlueNoise };
+
+const char * sample_pattern_name(SamplePattern pattern);
+
+// `seed` picks the random shift of the Halton and Sobol sets and drives the
+// white noise and best-candidate generators
+std::vector<glm::vec2> generate_samples(SamplePattern pattern, size_t count, uint32_t seed = 10086);
+
+// Offset for per-frame Cranley-Patterson rotation, following the R2
+// sequence so that successive frames cover the domain evenly
+glm::vec2 sample_frame_offset(uint64_t frame);
+
+// A sample set in an RG32F texture buffer, fetched with texelFetch
+class SampleSet {
+public:
+    SampleSet(SamplePattern pattern, size_t count);
+
+    // Regenerates when the pattern changes or more samples are needed. The
+    // size grows in powers of two, the existing prefix stays the same.
+    void require(SamplePattern pattern, size_t count);
+
+    SamplePattern pattern() const;
+    size_t        size() const;
+    GLuint        texture() const;
+
+private:
+    void generate();
+
+    SamplePattern                  _pattern;
+    size_t                         _size;
+    std::unique_ptr<Buffer>        _buffer;
+    std::unique_ptr<TextureBuffer> _texture;
+};
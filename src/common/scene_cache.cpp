@@ -0,0 +1,83 @@
+#include "scene_cache.hpp"
+#include <iostream>
+#include <unordered_set>
+
+SceneCache::SceneCache(size_t budget_bytes):
+    _budget(budget_bytes) {}
+
+std::shared_ptr<Gltf> SceneCache::find(const fs::path & name) {
+    for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+        if (it->name == name) {
+            _entries.splice(_entries.begin(), _entries, it);
+            _hits++;
+            return it->scene;
+        }
+    }
+    _misses++;
+    return nullptr;
+}
+
+void SceneCache::insert(const fs::path & name, std::shared_ptr<Gltf> scene) {
+    _entries.remove_if([&](const Entry & entry) { return entry.name == name; });
+    _entries.push_front(Entry { name, std::move(scene) });
+    evict();
+}
+
+std::shared_ptr<Texture2D> SceneCache::find_texture(const std::string & key) {
+    auto it = _textures.find(key);
+    if (it == _textures.end()) {
+        return nullptr;
+    }
+    auto texture = it->second.lock();
+    if (texture == nullptr) {
+        _textures.erase(it);
+    }
+    return texture;
+}
+
+void SceneCache::insert_texture(const std::string & key, const std::shared_ptr<Texture2D> & texture) {
+    _textures[key] = texture;
+}
+
+void SceneCache::set_budget(size_t budget_bytes) {
+    _budget = budget_bytes;
+    evict();
+}
+
+size_t SceneCache::budget() const {
+    return _budget;
+}
+
+SceneCache::Stats SceneCache::stats() const {
+    Stats stats {};
+    stats.hits            = _hits;
+    stats.misses          = _misses;
+    stats.evictions       = _evictions;
+    stats.resident_scenes = _entries.size();
+
+    std::unordered_set<const Texture2D *> counted;
+    for (auto & entry : _entries) {
+        auto & scene = *entry.scene;
+        stats.gpu_bytes += scene.gpu_bytes();
+        stats.cpu_bytes += scene.cpu_bytes();
+        for (size_t i = 0; i < scene.textures.size(); i++) {
+            if (counted.insert(scene.textures[i].get()).second) {
+                stats.gpu_bytes += scene.texture_bytes[i];
+            }
+        }
+    }
+    return stats;
+}
+
+void SceneCache::evict() {
+    // the most recent entry is the one about to be shown, it always stays
+    while (_entries.size() > 1) {
+        auto stats = this->stats();
+        if (stats.gpu_bytes + stats.cpu_bytes <= _budget) {
+            break;
+        }
+        std::cout << "scene cache: evicting " << _entries.back().name.string() << std::endl;
+        _entries.pop_back();
+        _evictions++;
+    }
+}
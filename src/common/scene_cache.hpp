@@ -0,0 +1,54 @@
+#pragma once
+
+#include "gltf.hpp"
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Keeps loaded scenes resident so revisiting one skips the parse and the
+// upload. Scenes are evicted least recently used first once their memory
+// exceeds the budget. Textures are shared between scenes by source image
+// and sampler, so they are counted once no matter how many scenes use them.
+class SceneCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t   resident_scenes;
+        size_t   gpu_bytes;
+        size_t   cpu_bytes;
+    };
+
+    explicit SceneCache(size_t budget_bytes);
+
+    // Returns nullptr on a miss
+    std::shared_ptr<Gltf> find(const fs::path & name);
+    void                  insert(const fs::path & name, std::shared_ptr<Gltf> scene);
+
+    std::shared_ptr<Texture2D> find_texture(const std::string & key);
+    void                       insert_texture(const std::string & key, const std::shared_ptr<Texture2D> & texture);
+
+    void   set_budget(size_t budget_bytes);
+    size_t budget() const;
+    Stats  stats() const;
+
+private:
+    struct Entry {
+        fs::path              name;
+        std::shared_ptr<Gltf> scene;
+    };
+
+    void evict();
+
+    size_t _budget;
+    // most recently used first
+    std::list<Entry> _entries;
+    // scenes own their textures, the cache only tracks the live ones
+    std::unordered_map<std::string, std::weak_ptr<Texture2D>> _textures;
+
+    uint64_t _hits      = 0;
+    uint64_t _misses    = 0;
+    uint64_t _evictions = 0;
+};
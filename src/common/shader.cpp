@@ -1,14 +1,18 @@
 #include "shader.hpp"
+#include "profile.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
 
-static GLuint compile_shader(const char *text, GLenum type, const char *name) {
-  GLuint shader = glCreateShader(type);
-  glShaderSource(shader, 1, &text, NULL);
-  glCompileShader(shader);
-
+static void check_shader(GLuint shader, const char *name) {
   GLint is_compiled = 0;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &is_compiled);
   if (is_compiled == GL_FALSE) {
@@ -22,21 +26,42 @@ static GLuint compile_shader(const char *text, GLenum type, const char *name) {
     std::stringstream ss;
     ss << "failed to compile shader \""
        << (name == nullptr ? "<unknown>" : name) << "\": " << error_log.data();
+    throw std::runtime_error(ss.str());
+  }
+}
 
+static GLuint compile_shader(const char *text,
+                             GLint length,
+                             GLenum type,
+                             const char *name) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &text, &length);
+  glCompileShader(shader);
+  try {
+    check_shader(shader, name);
+  } catch (...) {
     glDeleteShader(shader); // Don't leak the shader.
-    throw std::runtime_error(ss.str());
+    throw;
   }
   return shader;
 }
 
 Shader::Shader(const char *text, GLenum stage, const char *name) {
-  _id = compile_shader(text, stage, name);
+  _id = compile_shader(text, -1, stage, name);
+}
+
+Shader::Shader(std::span<const uint8_t> text, GLenum stage, const char *name) {
+  _id = compile_shader(
+      (const char *)text.data(), (GLint)text.size(), stage, name);
 }
 
 Shader::Shader(const fs::path &name, GLenum stage) {
-  auto data = Data::load(name);
-  data.push_back(0);
-  _id = compile_shader((const char *)data.data(), stage, name.string().c_str());
+  auto file = Data::map(name);
+  auto text = file.bytes();
+  _id = compile_shader((const char *)text.data(),
+                       (GLint)text.size(),
+                       stage,
+                       name.string().c_str());
 }
 
 Shader::~Shader() {
@@ -47,13 +72,7 @@ GLuint Shader::get() const {
   return _id;
 }
 
-static GLuint link_program(const GLuint *shaders, uint32_t shader_count) {
-  GLuint program = glCreateProgram();
-  for (uint32_t i = 0; i < shader_count; i++) {
-    glAttachShader(program, shaders[i]);
-  }
-  glLinkProgram(program);
-
+static void check_program(GLuint program) {
   int success;
   // check for linking errors
   glGetProgramiv(program, GL_LINK_STATUS, &success);
@@ -65,9 +84,22 @@ static GLuint link_program(const GLuint *shaders, uint32_t shader_count) {
 
     std::stringstream ss;
     ss << "failed to link program: " << error_log.data();
-    glDeleteProgram(program);
     throw std::runtime_error(ss.str());
   }
+}
+
+static GLuint link_program(const GLuint *shaders, uint32_t shader_count) {
+  GLuint program = glCreateProgram();
+  for (uint32_t i = 0; i < shader_count; i++) {
+    glAttachShader(program, shaders[i]);
+  }
+  glLinkProgram(program);
+  try {
+    check_program(program);
+  } catch (...) {
+    glDeleteProgram(program);
+    throw;
+  }
   return program;
 }
 
@@ -94,20 +126,448 @@ std::unique_ptr<Program> Program::create_from_source(const char *vert_source,
   return std::make_unique<Program>(shaders, 2);
 }
 
-std::unique_ptr<Program> Program::create_from_files(const fs::path &vert_file,
-                                                    const fs::path &frag_file) {
-  auto vert_shader = std::make_unique<Shader>(vert_file, GL_VERTEX_SHADER);
-  auto frag_shader = std::make_unique<Shader>(frag_file, GL_FRAGMENT_SHADER);
-  GLuint shaders[] = {vert_shader->get(), frag_shader->get()};
+std::unique_ptr<Program> Program::create_from_files(
+    const fs::path &vert_file,
+    const fs::path &frag_file,
+    const ShaderDefines &defines) {
+  auto build = begin_build(
+      {{vert_file, GL_VERTEX_SHADER}, {frag_file, GL_FRAGMENT_SHADER}},
+      defines);
+  return finish_build(*build);
+}
 
-  return std::make_unique<Program>(shaders, 2);
+std::unique_ptr<Program> Program::create_from_files(
+    const fs::path &vert_file,
+    const fs::path &geom_file,
+    const fs::path &frag_file,
+    const ShaderDefines &defines) {
+  auto build = begin_build({{vert_file, GL_VERTEX_SHADER},
+                            {geom_file, GL_GEOMETRY_SHADER},
+                            {frag_file, GL_FRAGMENT_SHADER}},
+                           defines);
+  return finish_build(*build);
 }
 
-std::unique_ptr<Program> Program::create_from_files(const fs::path & vert_file, const fs::path & geom_file, const fs::path & frag_file) {
-  auto vert_shader = std::make_unique<Shader>(vert_file, GL_VERTEX_SHADER);
-  auto geom_shader = std::make_unique<Shader>(geom_file, GL_GEOMETRY_SHADER);
-  auto frag_shader = std::make_unique<Shader>(frag_file, GL_FRAGMENT_SHADER);
-  GLuint shaders[] = {vert_shader->get(), geom_shader->get(), frag_shader->get()};
+namespace {
+// The source is passed to GL as three pieces: the mapped file up to and
+// including the #version line, the injected defines and the rest of the file,
+// so the text is never copied.
+struct StageSource {
+  std::string name;
+  GLenum stage;
+  MappedFile file;
+  std::string defines;
+  size_t split = 0;
+
+  std::array<const char *, 3> strings() const {
+    auto text = (const char *)file.bytes().data();
+    return {text, defines.data(), text + split};
+  }
+
+  std::array<GLint, 3> lengths() const {
+    return {(GLint)split,
+            (GLint)defines.size(),
+            (GLint)(file.bytes().size() - split)};
+  }
+};
+
+// FNV-1a, only used to name cache entries
+void hash_bytes(uint64_t &hash, const void *data, size_t size) {
+  auto bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+}
+
+void hash_string(uint64_t &hash, const char *str) {
+  if (str != nullptr) {
+    hash_bytes(hash, str, std::strlen(str) + 1);
+  }
+}
+
+// the binary is only valid for the exact driver that produced it, so the
+// driver strings are part of the key
+fs::path program_cache_file(const std::vector<StageSource> &stages) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash_string(hash, (const char *)glGetString(GL_VENDOR));
+  hash_string(hash, (const char *)glGetString(GL_RENDERER));
+  hash_string(hash, (const char *)glGetString(GL_VERSION));
+  for (auto &stage : stages) {
+    hash_bytes(hash, &stage.stage, sizeof(stage.stage));
+    auto strings = stage.strings();
+    auto lengths = stage.lengths();
+    for (size_t i = 0; i < strings.size(); i++) {
+      hash_bytes(hash, strings[i], lengths[i]);
+    }
+  }
+  std::stringstream ss;
+  ss << "program-" << std::hex << std::setw(16) << std::setfill('0') << hash
+     << ".bin";
+  return Data::cache_path() / ss.str();
+}
+
+bool program_binary_supported() {
+  return GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary;
+}
+
+GLuint load_program_binary(const fs::path &file) {
+  std::ifstream ifs(file, std::ios::binary);
+  if (!ifs) {
+    return 0;
+  }
+  GLenum format = 0;
+  if (!ifs.read((char *)&format, sizeof(format))) {
+    return 0;
+  }
+  std::vector<char> binary{std::istreambuf_iterator<char>(ifs), {}};
+  if (binary.empty()) {
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, format, binary.data(), (GLsizei)binary.size());
+  GLint success = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    // stale or foreign binary, the caller compiles from source instead
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void save_program_binary(GLuint program, const fs::path &file) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+
+  std::error_code ec;
+  fs::create_directories(file.parent_path(), ec);
+  std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    std::cout << "warn: cannot write program cache " << file.string()
+              << std::endl;
+    return;
+  }
+  ofs.write((const char *)&format, sizeof(format));
+  ofs.write(binary.data(), length);
+}
+} // namespace
+
+struct Program::Build {
+  std::string label;
+  std::vector<StageSource> stages;
+  fs::path cache_file;
+  bool use_cache = false;
+  bool cache_hit = false;
+  std::vector<GLuint> shaders;
+  GLuint program = 0;
+  std::chrono::steady_clock::time_point start;
+
+  ~Build() {
+    for (auto shader : shaders) {
+      glDeleteShader(shader);
+    }
+    if (program != 0) {
+      glDeleteProgram(program);
+    }
+  }
+};
+
+namespace {
+// defines go right after the #version line, which has to stay first
+std::string define_lines(const ShaderDefines &defines) {
+  std::string lines;
+  for (auto &[name, value] : defines) {
+    lines += "#define " + name + " " + value + "\n";
+  }
+  return lines;
+}
+
+size_t version_line_end(std::span<const uint8_t> text) {
+  static const char version[] = "#version";
+  auto it = std::search(text.begin(), text.end(), version, version + 8);
+  if (it == text.end()) {
+    return 0;
+  }
+  auto end = std::find(it, text.end(), '\n');
+  return end == text.end() ? text.size() : (size_t)(end - text.begin()) + 1;
+}
+
+bool parallel_compile_supported() {
+  return GLEW_ARB_parallel_shader_compile || GLEW_KHR_parallel_shader_compile;
+}
+} // namespace
+
+std::unique_ptr<Program::Build>
+Program::begin_build(const ShaderStages &files, const ShaderDefines &defines) {
+  MICROPROFILE_SCOPEI("Shader", "BeginBuild", 0xb5838d);
+  auto build = std::make_unique<Build>();
+  build->start = std::chrono::steady_clock::now();
+
+  auto lines = define_lines(defines);
+  for (auto &[file, stage] : files) {
+    auto mapped = Data::map(file);
+    auto split = lines.empty() ? 0 : version_line_end(mapped.bytes());
+    build->stages.push_back(
+        StageSource{file.string(), stage, std::move(mapped), lines, split});
+    build->label += (build->label.empty() ? "" : ", ") + file.filename().string();
+  }
+  if (!defines.empty()) {
+    build->label += " [";
+    for (auto &[name, value] : defines) {
+      build->label += " " + name + "=" + value;
+    }
+    build->label += " ]";
+  }
+
+  build->use_cache = program_binary_supported();
+  if (build->use_cache) {
+    build->cache_file = program_cache_file(build->stages);
+    build->program = load_program_binary(build->cache_file);
+    build->cache_hit = build->program != 0;
+    if (build->cache_hit) {
+      return build;
+    }
+  }
+
+  // only issue the work here, the status queries in finish_build are what
+  // block on drivers without parallel compilation
+  for (auto &stage : build->stages) {
+    auto strings = stage.strings();
+    auto lengths = stage.lengths();
+    GLuint shader = glCreateShader(stage.stage);
+    glShaderSource(
+        shader, (GLsizei)strings.size(), strings.data(), lengths.data());
+    glCompileShader(shader);
+    build->shaders.push_back(shader);
+  }
+  build->program = glCreateProgram();
+  for (auto shader : build->shaders) {
+    glAttachShader(build->program, shader);
+  }
+  if (build->use_cache) {
+    glProgramParameteri(
+        build->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glLinkProgram(build->program);
+  return build;
+}
+
+bool Program::build_ready(const Build &build) {
+  if (build.cache_hit || !parallel_compile_supported()) {
+    return true;
+  }
+  GLint done = GL_FALSE;
+  glGetProgramiv(build.program, GL_COMPLETION_STATUS_ARB, &done);
+  return done == GL_TRUE;
+}
+
+std::unique_ptr<Program> Program::finish_build(Build &build) {
+  MICROPROFILE_SCOPEI("Shader", "FinishBuild", 0xe5989b);
+  if (!build.cache_hit) {
+    for (size_t i = 0; i < build.shaders.size(); i++) {
+      check_shader(build.shaders[i], build.stages[i].name.c_str());
+    }
+    for (auto shader : build.shaders) {
+      glDetachShader(build.program, shader);
+      glDeleteShader(shader);
+    }
+    build.shaders.clear();
+    check_program(build.program);
+    if (build.use_cache) {
+      save_program_binary(build.program, build.cache_file);
+    }
+  }
+
+  auto program = std::unique_ptr<Program>(new Program());
+  program->_id = build.program;
+  build.program = 0;
+
+  std::chrono::duration<float, std::milli> elapsed =
+      std::chrono::steady_clock::now() - build.start;
+  // formatted aside, the manipulators would stick to std::cout
+  std::ostringstream ms;
+  ms << std::fixed << std::setprecision(1) << elapsed.count();
+  std::cout << "program " << build.label << ": "
+            << (build.cache_hit ? "cache hit" : "compiled") << " in "
+            << ms.str() << " ms" << std::endl;
+  return program;
+}
+
+ShaderCompiler::ShaderCompiler(std::function<void()> make_current,
+                               std::function<void()> release) :
+    _thread(&ShaderCompiler::loop,
+            this,
+            std::move(make_current),
+            std::move(release)) {}
+
+ShaderCompiler::~ShaderCompiler() {
+  {
+    std::lock_guard lock(_mutex);
+    _quit = true;
+  }
+  _cv.notify_all();
+  _thread.join();
+}
+
+bool ShaderCompiler::driver_compiles_in_parallel() {
+  return parallel_compile_supported();
+}
+
+std::future<std::unique_ptr<Program>>
+ShaderCompiler::build(const ShaderStages &stages,
+                      const ShaderDefines &defines) {
+  Task task{stages, defines, {}};
+  auto result = task.result.get_future();
+  {
+    std::lock_guard lock(_mutex);
+    _tasks.push_back(std::move(task));
+  }
+  _cv.notify_one();
+  return result;
+}
+
+void ShaderCompiler::loop(std::function<void()> make_current,
+                          std::function<void()> release) {
+  MicroProfileOnThreadCreate("ShaderCompiler");
+  make_current();
+  while (true) {
+    Task task;
+    {
+      std::unique_lock lock(_mutex);
+      _cv.wait(lock, [this] { return _quit || !_tasks.empty(); });
+      if (_quit) {
+        break;
+      }
+      task = std::move(_tasks.front());
+      _tasks.pop_front();
+    }
+    try {
+      auto build = Program::begin_build(task.stages, task.defines);
+      auto program = Program::finish_build(*build);
+      // the render context may only use the program once it is complete
+      glFinish();
+      task.result.set_value(std::move(program));
+    } catch (...) {
+      task.result.set_exception(std::current_exception());
+    }
+    // a program nobody waits for anymore is deleted here, with the
+    // shared context still current
+  }
+  release();
+  MicroProfileOnThreadExit();
+}
+
+ProgramPermutations::ProgramPermutations(const fs::path &vert_file,
+                                         const fs::path &frag_file,
+                                         ShaderCompiler *compiler) :
+    _stages{{vert_file, GL_VERTEX_SHADER}, {frag_file, GL_FRAGMENT_SHADER}},
+    _compiler(compiler) {
+  init();
+}
+
+ProgramPermutations::ProgramPermutations(const fs::path &vert_file,
+                                         const fs::path &geom_file,
+                                         const fs::path &frag_file,
+                                         ShaderCompiler *compiler) :
+    _stages{{vert_file, GL_VERTEX_SHADER},
+            {geom_file, GL_GEOMETRY_SHADER},
+            {frag_file, GL_FRAGMENT_SHADER}},
+    _compiler(compiler) {
+  init();
+}
+
+ProgramPermutations::~ProgramPermutations() = default;
+
+void ProgramPermutations::init() {
+  if (parallel_compile_supported()) {
+    _compiler = nullptr;
+  }
+  if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+  } else if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  }
+}
+
+Program *ProgramPermutations::get(const ShaderDefines &defines) {
+  auto it = _ready.find(defines);
+  if (it != _ready.end()) {
+    return it->second.get();
+  }
+  auto queued = std::find(_queued.begin(), _queued.end(), defines);
+  auto building = std::find_if(
+      _building.begin(), _building.end(), [&](auto &b) {
+        return b.first == defines;
+      });
+  auto compiling = std::find_if(
+      _compiling.begin(), _compiling.end(), [&](auto &c) {
+        return c.first == defines;
+      });
+  if (queued == _queued.end() && building == _building.end() &&
+      compiling == _compiling.end()) {
+    _queued.push_back(defines);
+  }
+  return nullptr;
+}
+
+void ProgramPermutations::poll() {
+  MICROPROFILE_SCOPEI("Shader", "PollPermutations", 0xb5838d);
+  if (_compiler != nullptr) {
+    for (auto &defines : _queued) {
+      _compiling.emplace_back(defines, _compiler->build(_stages, defines));
+    }
+    _queued.clear();
+    for (auto it = _compiling.begin(); it != _compiling.end();) {
+      if (it->second.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        ++it;
+        continue;
+      }
+      try {
+        _ready[it->first] = it->second.get();
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        _ready[it->first] = nullptr;
+      }
+      it = _compiling.erase(it);
+    }
+    return;
+  }
+
+  // without parallel compilation each build blocks, so take one per frame
+  size_t submit = parallel_compile_supported() ? _queued.size()
+                                               : (_building.empty() ? 1 : 0);
+  for (size_t i = 0; i < submit && !_queued.empty(); i++) {
+    auto defines = std::move(_queued.front());
+    _queued.erase(_queued.begin());
+    auto build = Program::begin_build(_stages, defines);
+    _building.emplace_back(std::move(defines), std::move(build));
+  }
+
+  for (auto it = _building.begin(); it != _building.end();) {
+    if (!Program::build_ready(*it->second)) {
+      ++it;
+      continue;
+    }
+    try {
+      _ready[it->first] = Program::finish_build(*it->second);
+    } catch (std::exception &e) {
+      // remember the failure so that it is not rebuilt every frame
+      std::cerr << e.what() << std::endl;
+      _ready[it->first] = nullptr;
+    }
+    it = _building.erase(it);
+  }
+}
 
-  return std::make_unique<Program>(shaders, 3);
+size_t ProgramPermutations::pending() const {
+  return _queued.size() + _building.size() + _compiling.size();
 }
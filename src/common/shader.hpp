@@ -2,10 +2,28 @@
 
 #include "data.hpp"
 #include <GL/glew.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Preprocessor defines injected after the #version line of every stage
+using ShaderDefines = std::map<std::string, std::string>;
+using ShaderStages = std::vector<std::pair<fs::path, GLenum>>;
 
 class Shader {
 public:
   Shader(const char *text, GLenum stage, const char *name = nullptr);
+  Shader(std::span<const uint8_t> text,
+         GLenum stage,
+         const char *name = nullptr);
   Shader(const fs::path &name, GLenum stage);
   ~Shader();
 
@@ -22,15 +40,105 @@ public:
 
   static std::unique_ptr<Program> create_from_source(const char *vert_source,
                                                      const char *frag_source);
-  static std::unique_ptr<Program> create_from_files(const fs::path &vert_file,
-                                                    const fs::path &frag_file);
-  static std::unique_ptr<Program> create_from_files(const fs::path &vert_file,
-                                                    const fs::path &geom_file,
-                                                    const fs::path &frag_file);
+  static std::unique_ptr<Program>
+  create_from_files(const fs::path &vert_file,
+                    const fs::path &frag_file,
+                    const ShaderDefines &defines = {});
+  static std::unique_ptr<Program>
+  create_from_files(const fs::path &vert_file,
+                    const fs::path &geom_file,
+                    const fs::path &frag_file,
+                    const ShaderDefines &defines = {});
 
   GLuint get() const;
 
 private:
+  friend class ProgramPermutations;
+  friend class ShaderCompiler;
+  struct Build;
+
+  Program() = default;
+
+  // Builds go through the on-disk program binary cache when the driver
+  // supports it. begin_build only issues the compile and link, finish_build
+  // checks the result.
+  static std::unique_ptr<Build> begin_build(const ShaderStages &files,
+                                            const ShaderDefines &defines);
+  static bool build_ready(const Build &build);
+  static std::unique_ptr<Program> finish_build(Build &build);
+
   void init(GLuint *shaders, uint32_t count);
   GLuint _id{};
+};
+
+// Builds programs on a thread of its own, in a hidden GL context that shares
+// objects with the render context, for drivers that cannot compile in the
+// background by themselves. Programs are shared objects, so a finished
+// program is handed back as is.
+class ShaderCompiler {
+public:
+  // `make_current` binds the shared context on the compiler thread, where
+  // `release` unbinds it again before the thread exits
+  ShaderCompiler(std::function<void()> make_current,
+                 std::function<void()> release);
+  ~ShaderCompiler();
+
+  ShaderCompiler(const ShaderCompiler &) = delete;
+  ShaderCompiler &operator=(const ShaderCompiler &) = delete;
+
+  // True if the driver has parallel shader compilation, a compiler thread
+  // gains nothing then
+  static bool driver_compiles_in_parallel();
+
+  // Queues a build, the future holds the program or the build error
+  std::future<std::unique_ptr<Program>> build(const ShaderStages &stages,
+                                              const ShaderDefines &defines);
+
+private:
+  struct Task {
+    ShaderStages stages;
+    ShaderDefines defines;
+    std::promise<std::unique_ptr<Program>> result;
+  };
+
+  void loop(std::function<void()> make_current, std::function<void()> release);
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<Task> _tasks;
+  bool _quit = false;
+  std::thread _thread;
+};
+
+// Specialized variants of one program, keyed by their defines. get() returns
+// nullptr until the variant is built so callers can keep using a generic
+// program meanwhile. Variants compile in the background where the driver
+// supports parallel compilation, otherwise on the `compiler` thread if one
+// is given. Without either poll() builds one per call.
+class ProgramPermutations {
+public:
+  ProgramPermutations(const fs::path &vert_file,
+                      const fs::path &frag_file,
+                      ShaderCompiler *compiler = nullptr);
+  ProgramPermutations(const fs::path &vert_file,
+                      const fs::path &geom_file,
+                      const fs::path &frag_file,
+                      ShaderCompiler *compiler = nullptr);
+  ~ProgramPermutations();
+
+  Program *get(const ShaderDefines &defines);
+  void poll();
+  size_t pending() const;
+
+private:
+  void init();
+
+  ShaderStages _stages;
+  ShaderCompiler *_compiler;
+  std::map<ShaderDefines, std::unique_ptr<Program>> _ready;
+  std::vector<ShaderDefines> _queued;
+  std::vector<std::pair<ShaderDefines, std::unique_ptr<Program::Build>>>
+      _building;
+  std::vector<std::pair<ShaderDefines, std::future<std::unique_ptr<Program>>>>
+      _compiling;
 };
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "streaming.hpp"
+#include "profile.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace {
+    // a page keeps its requested level for a while after leaving the view,
+    // so that it is not evicted and streamed again when turning around
+    const uint64_t KEEP_FRAMES = 120;
+} // namespace
+
+TextureStreamer::TextureStreamer(size_t budget):
+    _budget(budget) {}
+
+void TextureStreamer::begin_frame(const Gltf & scene) {
+    if (&scene != _scene || _pages.size() != scene.page_sources.size()) {
+        _scene = &scene;
+        _pages.clear();
+        for (auto & source : scene.page_sources) {
+            _pages.push_back(Page { source.tail_level, INT_MAX, _frame });
+        }
+    }
+    _frame++;
+    for (auto & page : _pages) {
+        page.requested = INT_MAX;
+    }
+}
+
+void TextureStreamer::request(const Gltf & scene, uint32_t draw, const glm::vec3 & eye, float pixel_scale) {
+    auto bounds = scene.draw_bounds(draw);
+    // to the nearest point of the box, zero from inside
+    float  distance  = glm::length(glm::clamp(eye, bounds.min, bounds.max) - eye);
+    float  pixels    = pixel_scale / std::max(distance, 1e-4f);
+    auto & transform = scene.draws[draw].transform;
+    // the least stretched axis needs the most texels
+    float scale = std::min({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+    for (auto & batch : scene.batches[scene.draws[draw].index]) {
+        if (batch.page < 0) continue;
+        auto & source = scene.page_sources[batch.page];
+        int    level  = source.levels() - 1;
+        if (batch.uv_density > 0.0f && scale > 0.0f) {
+            // texels of the finest level per pixel, each level halves them
+            float texels = (float) std::max(source.width, source.height) * batch.uv_density / scale;
+            level        = std::clamp((int) std::floor(std::log2(texels / pixels)), 0, level);
+        }
+        auto & page    = _pages[batch.page];
+        page.requested = std::min(page.requested, level);
+    }
+}
+
+bool TextureStreamer::update(Gltf & scene) {
+    MICROPROFILE_SCOPEI("Streaming", "Update", 0xf4a261);
+    size_t resident = 0;
+    for (size_t i = 0; i < _pages.size(); i++) {
+        auto & page   = _pages[i];
+        auto & source = scene.page_sources[i];
+        if (page.requested != INT_MAX) {
+            page.wanted         = page.requested;
+            page.last_requested = _frame;
+        } else if (_frame - page.last_requested > KEEP_FRAMES) {
+            page.wanted = source.tail_level;
+        }
+        page.wanted = std::min(page.wanted, source.tail_level);
+        resident += source.bytes(source.resident_level);
+    }
+
+    bool changed = false;
+    auto drop    = [&](int page) {
+        auto & source = scene.page_sources[page];
+        resident -= source.bytes(source.resident_level) - source.bytes(source.resident_level + 1);
+        scene.set_page_level(page, source.resident_level + 1);
+        _stats.evictions++;
+        changed = true;
+    };
+    // a lowered budget may take levels that are still needed
+    while (resident > _budget) {
+        int page = victim(scene, true);
+        if (page < 0) break;
+        drop(page);
+    }
+
+    // the pages furthest from their requests first, the first one that
+    // fits is streamed
+    _candidates.clear();
+    for (size_t i = 0; i < _pages.size(); i++) {
+        if (scene.page_sources[i].resident_level > _pages[i].wanted) _candidates.push_back((int) i);
+    }
+    std::stable_sort(_candidates.begin(), _candidates.end(), [&](int a, int b) {
+        return scene.page_sources[a].resident_level - _pages[a].wanted > scene.page_sources[b].resident_level - _pages[b].wanted;
+    });
+    for (int candidate : _candidates) {
+        auto & source = scene.page_sources[candidate];
+        auto   extra  = source.bytes(source.resident_level - 1) - source.bytes(source.resident_level);
+        // but never for another page's request
+        while (resident + extra > _budget) {
+            int page = victim(scene, false);
+            if (page < 0 || page == candidate) break;
+            drop(page);
+        }
+        if (resident + extra <= _budget) {
+            scene.set_page_level(candidate, source.resident_level - 1);
+            resident += extra;
+            _stats.uploads++;
+            changed = true;
+            break;
+        }
+    }
+    _stats.resident_bytes = resident;
+    return changed;
+}
+
+int TextureStreamer::victim(const Gltf & scene, bool needed) const {
+    int best = -1;
+    for (size_t i = 0; i < _pages.size(); i++) {
+        auto & page   = _pages[i];
+        auto & source = scene.page_sources[i];
+        if (source.resident_level >= source.tail_level) continue;
+        bool surplus = source.resident_level < page.wanted;
+        if (! surplus && ! needed) continue;
+        if (best < 0) {
+            best = (int) i;
+            continue;
+        }
+        // surplus levels go first, then the oldest requests
+        auto & other        = _pages[best];
+        bool   best_surplus = scene.page_sources[best].resident_level < other.wanted;
+        if (surplus != best_surplus ? surplus : page.last_requested < other.last_requested) {
+            best = (int) i;
+        }
+    }
+    return best;
+}
+
+void TextureStreamer::set_budget(size_t bytes) {
+    _budget = bytes;
+}
+
+size_t TextureStreamer::budget() const {
+    return _budget;
+}
+
+TextureStreamer::Stats TextureStreamer::stats() const {
+    return _stats;
+}
+
+const std::vector<TextureStreamer::Page> & TextureStreamer::pages() const {
+    return _pages;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "gltf.hpp"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Decides which mip levels of a scene's base color pages are resident.
+// Every frame the visible draws request the finest level their texel
+// density needs on screen, then update() streams one level of the page
+// furthest from its request that fits the budget. To make room, levels
+// finer than requested are dropped, least recently requested pages first.
+class TextureStreamer {
+public:
+    struct Page {
+        int      wanted;         // finest level requested recently
+        int      requested;      // finest level requested this frame
+        uint64_t last_requested; // frame of the last request
+    };
+
+    struct Stats {
+        size_t   resident_bytes; // all pages of the scene
+        uint64_t uploads;        // levels streamed in
+        uint64_t evictions;      // levels dropped
+    };
+
+    explicit TextureStreamer(size_t budget);
+
+    // Starts collecting the requests of a frame. The state of the previous
+    // scene is dropped when it changes.
+    void begin_frame(const Gltf & scene);
+
+    // Requests the levels of the draw's pages it needs seen from `eye`.
+    // `pixel_scale` is the size in pixels of a unit long object at distance
+    // 1, half the viewport height times projection[1][1].
+    void request(const Gltf & scene, uint32_t draw, const glm::vec3 & eye, float pixel_scale);
+
+    // Moves the pages toward their requests within the budget, returns true
+    // if one of them changed. Must be called on the GL thread.
+    bool update(Gltf & scene);
+
+    void   set_budget(size_t bytes);
+    size_t budget() const;
+    Stats  stats() const;
+    // of the scene passed to begin_frame, indexed like its pages
+    const std::vector<Page> & pages() const;
+
+private:
+    // Page whose finest level is dropped next, -1 if none. Unless `needed`
+    // is set only levels finer than requested are considered.
+    int victim(const Gltf & scene, bool needed) const;
+
+    const Gltf *      _scene = nullptr;
+    std::vector<Page> _pages;
+    std::vector<int>  _candidates;
+    uint64_t          _frame = 0;
+    size_t            _budget;
+    Stats             _stats {};
+};
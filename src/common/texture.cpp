@@ -1,16 +1,20 @@
 #include "texture.hpp"
+#include "profile.h"
+#include <algorithm>
 #include <sstream>
 #include <stb_image.h>
 
 Texture2D::Texture2D(const fs::path &name, TextureSettings *settings) {
-  auto full_path = Data::resolve(name).string();
+  MICROPROFILE_SCOPEI("Texture", "Decode", 0xe9c46a);
+  auto file = Data::map(name);
+  auto bytes = file.bytes();
   stbi_set_flip_vertically_on_load(true);
   int width, height, channels;
-  unsigned char *data =
-      stbi_load(full_path.c_str(), &width, &height, &channels, 0);
+  unsigned char *data = stbi_load_from_memory(
+      bytes.data(), (int)bytes.size(), &width, &height, &channels, 0);
   if (!data) {
     std::stringstream ss;
-    ss << "failed to load image " << full_path;
+    ss << "failed to load image " << Data::resolve(name).string();
     throw std::runtime_error(ss.str());
   }
   init(data, GL_UNSIGNED_BYTE, width, height, channels, settings);
@@ -25,6 +29,8 @@ void Texture2D::init(uint8_t *data,
                      GLenum internal_format,
                      GLenum format,
                      TextureSettings *settings) {
+  MICROPROFILE_SCOPEI("Texture", "Upload", 0xf4a261);
+  MICROPROFILE_SCOPEGPUI("TextureUpload", 0xf4a261);
   _width = width;
   _height = height;
   TextureSettings default_settings{};
@@ -47,7 +53,9 @@ void Texture2D::init(uint8_t *data,
                format,
                data_type,
                data);
-  glGenerateMipmap(GL_TEXTURE_2D);
+  if (settings->mipmaps) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
 }
 
 void Texture2D::init(uint8_t *data,
@@ -103,3 +111,105 @@ int Texture2D::width() const {
 int Texture2D::height() const {
   return _height;
 }
+
+Texture2DArray::Texture2DArray(GLenum data_type,
+                               int width,
+                               int height,
+                               int layers,
+                               int levels,
+                               TextureSettings *settings)
+    : _data_type(data_type), _width(width), _height(height), _layers(layers),
+      _levels(levels) {
+  TextureSettings default_settings{};
+  if (settings == nullptr) {
+    settings = &default_settings;
+  }
+  auto internal_format = data_type == GL_UNSIGNED_SHORT ? GL_RGBA16 : GL_RGBA8;
+  glGenTextures(1, &_tex_id);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, _tex_id);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, settings->wrap_s);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, settings->wrap_t);
+  glTexParameteri(
+      GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, settings->min_filter);
+  glTexParameteri(
+      GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, settings->max_filter);
+  // complete with fewer levels than a full chain
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, _levels - 1);
+  for (int level = 0; level < _levels; level++) {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY,
+                 level,
+                 internal_format,
+                 std::max(_width >> level, 1),
+                 std::max(_height >> level, 1),
+                 _layers,
+                 0,
+                 GL_RGBA,
+                 data_type,
+                 nullptr);
+  }
+}
+
+Texture2DArray::~Texture2DArray() {
+  glDeleteTextures(1, &_tex_id);
+}
+
+void Texture2DArray::upload_layer(int layer, int level, const uint8_t *data) {
+  MICROPROFILE_SCOPEI("Texture", "UploadLayer", 0xf4a261);
+  MICROPROFILE_SCOPEGPUI("TextureUpload", 0xf4a261);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, _tex_id);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY,
+                  level,
+                  0,
+                  0,
+                  layer,
+                  std::max(_width >> level, 1),
+                  std::max(_height >> level, 1),
+                  1,
+                  GL_RGBA,
+                  _data_type,
+                  data);
+}
+
+GLuint Texture2DArray::get() const {
+  return _tex_id;
+}
+
+int Texture2DArray::width() const {
+  return _width;
+}
+
+int Texture2DArray::height() const {
+  return _height;
+}
+
+int Texture2DArray::layers() const {
+  return _layers;
+}
+
+int Texture2DArray::levels() const {
+  return _levels;
+}
+
+size_t Texture2DArray::bytes() const {
+  size_t texel = _data_type == GL_UNSIGNED_SHORT ? 8 : 4;
+  size_t bytes = 0;
+  for (int level = 0; level < _levels; level++) {
+    bytes += (size_t)std::max(_width >> level, 1) *
+             std::max(_height >> level, 1) * _layers * texel;
+  }
+  return bytes;
+}
+
+TextureBuffer::TextureBuffer(GLenum internal_format, GLuint buffer) {
+  glGenTextures(1, &_tex_id);
+  glBindTexture(GL_TEXTURE_BUFFER, _tex_id);
+  glTexBuffer(GL_TEXTURE_BUFFER, internal_format, buffer);
+}
+
+TextureBuffer::~TextureBuffer() {
+  glDeleteTextures(1, &_tex_id);
+}
+
+GLuint TextureBuffer::get() const {
+  return _tex_id;
+}
@@ -10,6 +10,8 @@ struct TextureSettings {
   glm::vec4 border_color = glm::vec4(0.0, 0.0, 0.0, 0.0);
   GLenum min_filter = GL_LINEAR_MIPMAP_LINEAR;
   GLenum max_filter = GL_LINEAR;
+  // render targets and depth textures have no mip chain
+  bool mipmaps = true;
 };
 
 class Texture2D {
@@ -55,4 +57,46 @@ private:
             GLenum internal_format,
             GLenum format,
             TextureSettings *settings = nullptr);
-};
\ No newline at end of file
+};
+
+// RGBA layers of one size and data type sharing the sampler state, so
+// that textures of different materials can be read in a single draw. All
+// `levels` mip levels are allocated up front and filled by upload_layer.
+class Texture2DArray {
+public:
+  Texture2DArray(GLenum data_type,
+                 int width,
+                 int height,
+                 int layers,
+                 int levels,
+                 TextureSettings *settings = nullptr);
+  ~Texture2DArray();
+
+  void upload_layer(int layer, int level, const uint8_t *data);
+
+  GLuint get() const;
+
+  int width() const;
+  int height() const;
+  int layers() const;
+  int levels() const;
+  // including the mip chain
+  size_t bytes() const;
+
+private:
+  GLuint _tex_id;
+  GLenum _data_type;
+  int _width, _height, _layers, _levels;
+};
+
+// Exposes a buffer object to shaders as a samplerBuffer
+class TextureBuffer {
+public:
+  TextureBuffer(GLenum internal_format, GLuint buffer);
+  ~TextureBuffer();
+
+  GLuint get() const;
+
+private:
+  GLuint _tex_id;
+};
@@ -0,0 +1,294 @@
+#include "timing.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <imgui/imgui.h>
+#include <iostream>
+#include <utility>
+
+namespace {
+    using Duration = std::chrono::duration<float, std::milli>;
+
+    void store(std::vector<float> & values, size_t index, float value) {
+        if (values.size() <= index) {
+            values.resize(index + 1, 0.0f);
+        }
+        values[index] = value;
+    }
+} // namespace
+
+FrameTimings::Scope::Scope(FrameTimings & timings, size_t pass, bool gpu):
+    _timings(timings), _pass(pass), _gpu(gpu), _start(std::chrono::steady_clock::now()) {
+    if (_gpu) {
+        auto & p    = _timings._passes[_pass];
+        auto   slot = _timings._frame_index % LATENCY;
+        // an unresolved query from LATENCY frames ago is dropped rather than waited for
+        glQueryCounter(p.queries[slot][0], GL_TIMESTAMP);
+        p.query_frame[slot] = _timings._frame_index;
+        p.pending[slot]     = false;
+    }
+}
+
+FrameTimings::Scope::~Scope() {
+    if (_gpu) {
+        auto & p    = _timings._passes[_pass];
+        auto   slot = _timings._frame_index % LATENCY;
+        glQueryCounter(p.queries[slot][1], GL_TIMESTAMP);
+        p.pending[slot] = true;
+    }
+    if (auto * frame = _timings.find_frame(_timings._frame_index)) {
+        Duration elapsed = std::chrono::steady_clock::now() - _start;
+        store(frame->cpu_ms, _pass, elapsed.count());
+    }
+}
+
+FrameTimings::FrameTimings(size_t window):
+    _frames(window) {}
+
+FrameTimings::~FrameTimings() {
+    for (auto & pass : _passes) {
+        if (pass.gpu) {
+            glDeleteQueries(LATENCY * 2, pass.queries[0].data());
+        }
+    }
+}
+
+void FrameTimings::begin_frame() {
+    auto now = std::chrono::steady_clock::now();
+    if (auto * frame = find_frame(_frame_index)) {
+        frame->frame_ms = Duration(now - _last_frame_start).count();
+    }
+    _last_frame_start = now;
+
+    // a frame is complete once none of its queries is pending
+    auto resolved = _frame_index;
+    for (auto & pass : _passes) {
+        resolve_queries(pass);
+        for (size_t slot = 0; slot < LATENCY; slot++) {
+            if (pass.pending[slot]) {
+                resolved = std::min(resolved, pass.query_frame[slot] - 1);
+            }
+        }
+    }
+    _resolved_frame = resolved;
+
+    Frame frame;
+    frame.index = ++_frame_index;
+    frame.cpu_ms.assign(_passes.size(), 0.0f);
+    frame.gpu_ms.assign(_passes.size(), 0.0f);
+    _frames.push(std::move(frame));
+}
+
+FrameTimings::Scope FrameTimings::scope(const char * name, bool gpu) {
+    size_t index = 0;
+    while (index < _passes.size() && std::strcmp(_passes[index].name, name) != 0) {
+        index++;
+    }
+    if (index == _passes.size()) {
+        Pass pass {};
+        pass.name = name;
+        pass.gpu  = gpu;
+        if (gpu) {
+            glGenQueries(LATENCY * 2, pass.queries[0].data());
+        }
+        _passes.push_back(pass);
+    }
+    return Scope(*this, index, _passes[index].gpu);
+}
+
+FrameTimings::Percentiles FrameTimings::frame_percentiles() const {
+    std::vector<float> times;
+    times.reserve(_frames.size());
+    for (size_t i = 0; i < _frames.size(); i++) {
+        if (_frames[i].frame_ms > 0.0f) {
+            times.push_back(_frames[i].frame_ms);
+        }
+    }
+    if (times.empty()) {
+        return {};
+    }
+    std::sort(times.begin(), times.end());
+    auto at = [&](float p) {
+        return times[std::min(times.size() - 1, (size_t) (p * (float) times.size()))];
+    };
+    return { at(0.50f), at(0.95f), at(0.99f), times.back() };
+}
+
+float FrameTimings::average_cpu_ms(size_t pass) const {
+    float  sum   = 0.0f;
+    size_t count = 0;
+    for (size_t i = 0; i < _frames.size(); i++) {
+        auto & values = _frames[i].cpu_ms;
+        if (pass < values.size() && values[pass] > 0.0f) {
+            sum += values[pass];
+            count++;
+        }
+    }
+    return count == 0 ? 0.0f : sum / (float) count;
+}
+
+float FrameTimings::average_gpu_ms(size_t pass) const {
+    float  sum   = 0.0f;
+    size_t count = 0;
+    for (size_t i = 0; i < _frames.size(); i++) {
+        auto & values = _frames[i].gpu_ms;
+        if (pass < values.size() && values[pass] > 0.0f) {
+            sum += values[pass];
+            count++;
+        }
+    }
+    return count == 0 ? 0.0f : sum / (float) count;
+}
+
+uint64_t FrameTimings::current_frame() const {
+    return _frame_index;
+}
+
+uint64_t FrameTimings::resolved_frame() const {
+    return _resolved_frame;
+}
+
+float FrameTimings::gpu_frame_ms(uint64_t frame) const {
+    auto * found = find_frame(frame);
+    if (found == nullptr) {
+        return 0.0f;
+    }
+    float sum = 0.0f;
+    for (auto ms : found->gpu_ms) {
+        sum += ms;
+    }
+    return sum;
+}
+
+float FrameTimings::pass_gpu_ms(uint64_t frame, const char * name) const {
+    auto * found = find_frame(frame);
+    if (found == nullptr) {
+        return 0.0f;
+    }
+    for (size_t i = 0; i < _passes.size() && i < found->gpu_ms.size(); i++) {
+        if (std::strcmp(_passes[i].name, name) == 0) {
+            return found->gpu_ms[i];
+        }
+    }
+    return 0.0f;
+}
+
+size_t FrameTimings::pass_count() const {
+    return _passes.size();
+}
+
+const char * FrameTimings::pass_name(size_t pass) const {
+    return _passes[pass].name;
+}
+
+void FrameTimings::draw_overlay(bool * open) {
+    if (! ImGui::Begin("Frame Timings", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+
+    std::vector<float> times;
+    for (size_t i = 0; i + 1 < _frames.size(); i++) {
+        times.push_back(_frames[i].frame_ms);
+    }
+    auto percentiles = frame_percentiles();
+    ImGui::PlotLines("##frame_ms", times.data(), (int) times.size(), 0, "frame time (ms)", 0.0f, std::max(percentiles.max, 1.0f), ImVec2(400, 80));
+    ImGui::Text("p50 %.2f  p95 %.2f  p99 %.2f  max %.2f ms", percentiles.p50, percentiles.p95, percentiles.p99, percentiles.max);
+
+    if (ImGui::BeginTable("passes", 3, ImGuiTableFlags_Borders)) {
+        ImGui::TableSetupColumn("Pass");
+        ImGui::TableSetupColumn("CPU ms");
+        ImGui::TableSetupColumn("GPU ms");
+        ImGui::TableHeadersRow();
+        for (size_t i = 0; i < _passes.size(); i++) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(_passes[i].name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", average_cpu_ms(i));
+            ImGui::TableNextColumn();
+            if (_passes[i].gpu) {
+                ImGui::Text("%.2f", average_gpu_ms(i));
+            } else {
+                ImGui::TextUnformatted("-");
+            }
+        }
+        ImGui::EndTable();
+    }
+
+    if (ImGui::Button("Export CSV")) {
+        auto path = fs::absolute("ogl-frame-timings.csv");
+        if (export_csv(path)) {
+            std::cout << "frame timings written to " << path.string() << std::endl;
+        }
+    }
+    ImGui::End();
+}
+
+bool FrameTimings::export_csv(const fs::path & path) const {
+    std::ofstream ofs(path);
+    if (! ofs) {
+        std::cerr << "failed to write " << path.string() << std::endl;
+        return false;
+    }
+    ofs << "frame,frame_ms";
+    for (auto & pass : _passes) {
+        ofs << "," << pass.name << "_cpu_ms";
+        if (pass.gpu) {
+            ofs << "," << pass.name << "_gpu_ms";
+        }
+    }
+    ofs << "\n";
+    // the newest frame is still being measured
+    for (size_t i = 0; i + 1 < _frames.size(); i++) {
+        auto & frame = _frames[i];
+        ofs << frame.index << "," << frame.frame_ms;
+        for (size_t p = 0; p < _passes.size(); p++) {
+            ofs << "," << (p < frame.cpu_ms.size() ? frame.cpu_ms[p] : 0.0f);
+            if (_passes[p].gpu) {
+                ofs << "," << (p < frame.gpu_ms.size() ? frame.gpu_ms[p] : 0.0f);
+            }
+        }
+        ofs << "\n";
+    }
+    return true;
+}
+
+FrameTimings::Frame * FrameTimings::find_frame(uint64_t index) {
+    return const_cast<Frame *>(std::as_const(*this).find_frame(index));
+}
+
+const FrameTimings::Frame * FrameTimings::find_frame(uint64_t index) const {
+    if (_frames.empty() || index > _frames.back().index) {
+        return nullptr;
+    }
+    auto offset = _frames.back().index - index;
+    if (offset >= _frames.size()) {
+        return nullptr;
+    }
+    return &_frames[_frames.size() - 1 - offset];
+}
+
+void FrameTimings::resolve_queries(Pass & pass) {
+    if (! pass.gpu) {
+        return;
+    }
+    size_t index = &pass - _passes.data();
+    for (size_t slot = 0; slot < LATENCY; slot++) {
+        if (! pass.pending[slot]) {
+            continue;
+        }
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(pass.queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (! available) {
+            continue;
+        }
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(pass.queries[slot][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(pass.queries[slot][1], GL_QUERY_RESULT, &end);
+        pass.pending[slot] = false;
+        if (auto * frame = find_frame(pass.query_frame[slot])) {
+            store(frame->gpu_ms, index, (float) (end - begin) / 1.0e6f);
+        }
+    }
+}
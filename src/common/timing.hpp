@@ -0,0 +1,92 @@
+#pragma once
+
+#include "data.hpp"
+#include "utils.hpp"
+#include <array>
+#include <chrono>
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+// CPU and GPU time of named passes plus a window of frame times. GPU times
+// come from timestamp queries that are read back a few frames later, only
+// once available, so measuring never stalls the pipeline.
+class FrameTimings {
+public:
+    struct Percentiles {
+        float p50, p95, p99, max;
+    };
+
+    // Measures one pass until it goes out of scope
+    class Scope {
+    public:
+        Scope(FrameTimings & timings, size_t pass, bool gpu);
+        ~Scope();
+
+        Scope(const Scope &)             = delete;
+        Scope & operator=(const Scope &) = delete;
+
+    private:
+        FrameTimings &                        _timings;
+        size_t                                _pass;
+        bool                                  _gpu;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    explicit FrameTimings(size_t window = 300);
+    ~FrameTimings();
+
+    FrameTimings(const FrameTimings &)             = delete;
+    FrameTimings & operator=(const FrameTimings &) = delete;
+
+    void begin_frame();
+
+    // Passes are registered on first use, `name` must outlive the timings.
+    // GPU timing is optional for passes that submit no GL work.
+    [[nodiscard]] Scope scope(const char * name, bool gpu = true);
+
+    Percentiles  frame_percentiles() const;
+    float        average_cpu_ms(size_t pass) const;
+    float        average_gpu_ms(size_t pass) const;
+    // Frame being measured, passes scoped now are attributed to it
+    uint64_t     current_frame() const;
+    // Newest frame whose GPU queries have been read back, 0 before the first
+    uint64_t     resolved_frame() const;
+    // Sum of the GPU pass times of a frame still in the window
+    float        gpu_frame_ms(uint64_t frame) const;
+    // GPU time of one pass in a frame, 0 if it did not run
+    float        pass_gpu_ms(uint64_t frame, const char * name) const;
+    size_t       pass_count() const;
+    const char * pass_name(size_t pass) const;
+
+    void draw_overlay(bool * open);
+    bool export_csv(const fs::path & path) const;
+
+private:
+    // frames a query set may stay in flight before its slot is reused
+    static constexpr size_t LATENCY = 3;
+
+    struct Pass {
+        const char *                               name;
+        bool                                       gpu;
+        std::array<std::array<GLuint, 2>, LATENCY> queries {};
+        std::array<uint64_t, LATENCY>              query_frame {};
+        std::array<bool, LATENCY>                  pending {};
+    };
+
+    struct Frame {
+        uint64_t           index    = 0;
+        float              frame_ms = 0.0f;
+        std::vector<float> cpu_ms, gpu_ms;
+    };
+
+    Frame *       find_frame(uint64_t index);
+    const Frame * find_frame(uint64_t index) const;
+    void    resolve_queries(Pass & pass);
+
+    std::vector<Pass>                     _passes;
+    FixSizeQueue<Frame>                   _frames;
+    uint64_t                              _frame_index = 0;
+    uint64_t                              _resolved_frame = 0;
+    std::chrono::steady_clock::time_point _last_frame_start;
+};
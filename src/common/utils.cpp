@@ -1,4 +1,14 @@
 #include "utils.hpp"
+#include <cstring>
+#include <fstream>
+#include <string>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 glm::vec3 polar_to_cartesian(float yaw, float pitch) {
   float y = cosf(pitch);
@@ -7,3 +17,46 @@ glm::vec3 polar_to_cartesian(float yaw, float pitch) {
   float z = sinPitch * sinf(yaw);
   return glm::vec3(x, y, z);
 }
+
+namespace {
+#ifdef __linux__
+// a "VmRSS:"-style field of /proc/self/status, which is given in kB
+size_t proc_status_bytes(const char *field) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind(field, 0) == 0) {
+      return std::stoull(line.substr(std::strlen(field))) * 1024;
+    }
+  }
+  return 0;
+}
+#endif
+} // namespace
+
+size_t resident_bytes() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters{};
+  K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+  return counters.WorkingSetSize;
+#elif defined(__linux__)
+  return proc_status_bytes("VmRSS:");
+#else
+  return 0;
+#endif
+}
+
+size_t peak_resident_bytes() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters{};
+  K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+  return counters.PeakWorkingSetSize;
+#elif defined(__linux__)
+  return proc_status_bytes("VmHWM:");
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  // bytes on macOS
+  return (size_t)usage.ru_maxrss;
+#endif
+}
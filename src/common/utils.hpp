@@ -1,47 +1,73 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <queue>
+#include <vector>
 
 glm::vec3 polar_to_cartesian(float yaw, float pitch);
 
+// Memory of the process in RAM and its high-water mark, 0 where the
+// platform does not report it
+size_t resident_bytes();
+size_t peak_resident_bytes();
+
+// Keeps the last max_size values in a fixed ring buffer, pushing into a full
+// queue overwrites the oldest value.
 template <typename T> class FixSizeQueue {
 public:
-  FixSizeQueue(size_t max_size) : _max_size(max_size) {}
+  FixSizeQueue(size_t max_size) : _values(max_size) {}
 
   void push(const T &value) {
-    _queue.push(value);
-    constrain_size();
+    if (_values.empty()) {
+      return;
+    }
+    _values[(_first + _size) % _values.size()] = value;
+    if (_size < _values.size()) {
+      _size++;
+    } else {
+      _first = (_first + 1) % _values.size();
+    }
   }
 
   template <typename... Args> void emplace(Args &&...args) {
-    _queue.emplace(std::forward<Args>(args)...);
-    constrain_size();
+    push(T(std::forward<Args>(args)...));
   }
 
   const T &front() const {
-    return _queue.front();
+    return (*this)[0];
   }
 
   const T &back() const {
-    return _queue.back();
+    return (*this)[_size - 1];
+  }
+
+  // index 0 is the oldest value
+  const T &operator[](size_t index) const {
+    return _values[(_first + index) % _values.size()];
+  }
+
+  T &operator[](size_t index) {
+    return _values[(_first + index) % _values.size()];
   }
 
   bool empty() const {
-    return _queue.empty();
+    return _size == 0;
   }
 
   size_t size() const {
-    return _queue.size();
+    return _size;
   }
 
-private:
-  void constrain_size() {
-    while (_queue.size() > _max_size) {
-      _queue.pop();
-    }
+  size_t capacity() const {
+    return _values.size();
   }
 
-  size_t _max_size;
-  std::queue<T> _queue{};
-};
\ No newline at end of file
+  void clear() {
+    _first = 0;
+    _size = 0;
+  }
+
+private:
+  std::vector<T> _values;
+  size_t _first = 0;
+  size_t _size = 0;
+};
@@ -10,8 +10,8 @@ protected:
     bool           _disableControl { false };
 
 public:
-    App(const char * name, int width, int height):
-        Application(name, width, height) {}
+    App(const char * name, int width, int height, const LaunchOptions & options = {}):
+        Application(name, width, height, options) {}
 
 public:
     void update() override {
@@ -32,7 +32,7 @@ public:
         glGenFramebuffers(1, &_id);
     }
     ~FrameBuffer() {
-        glDeleteBuffers(1, &_id);
+        glDeleteFramebuffers(1, &_id);
     }
 
     GLuint get() const {
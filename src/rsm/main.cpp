@@ -1,8 +1,23 @@
+#include "../common/capture.hpp"
 #include "../common/data.hpp"
+#include "../common/frame_pacing.hpp"
+#include "../common/framebuffer.hpp"
 #include "../common/gltf.hpp"
+#include "../common/governor.hpp"
+#include "../common/jobs.hpp"
 #include "../common/mesh.hpp"
+#include "../common/occlusion.hpp"
+#include "../common/profile.h"
+#include "../common/render_state.hpp"
+#include "../common/ring_buffer.hpp"
+#include "../common/renderer.hpp"
+#include "../common/sampling.hpp"
+#include "../common/scene_cache.hpp"
+#include "../common/streaming.hpp"
 #include "../common/shader.hpp"
 #include "../common/texture.hpp"
+#include "../common/timing.hpp"
+#include "../common/utils.hpp"
 #include "app.h"
 #include "classes.h"
 #include <GL/glew.h>
@@ -10,6 +25,12 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <imgui/imgui.h>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <tuple>
 #include <vector>
 // FOR DEBUGGING
 #include <iostream>
@@ -19,49 +40,274 @@ namespace rsm {
                  CORNELL_BOX,
                  FLIGHT_HELMET };
     const char * sceneNames[] = { "DEBUG_SCENE", "CORNELL_BOX", "FLIGHT_HELMET" };
+    const char * scenePaths[] = { "models/debug_scene/scene.gltf", "models/cornell_box/scene.gltf", "models/flight_helmet/scene.gltf" };
+
+    // Storage of the reflective shadow map, the flux and normal maps share
+    // the color format
+    struct RSMFormat {
+        const char * name;
+        GLenum       color, depth;
+        unsigned     colorBytes, depthBytes;
+    };
+    const RSMFormat rsmFormats[] = {
+        { "RGB8, depth 16", GL_RGB8, GL_DEPTH_COMPONENT16, 4, 2 },
+        { "RGB8, depth 24", GL_RGB8, GL_DEPTH_COMPONENT24, 4, 4 },
+        { "RGB16F, depth 32F", GL_RGB16F, GL_DEPTH_COMPONENT32F, 8, 4 },
+    };
+    const char *   rsmFaceNames[] = { "+X", "-X", "+Y", "-Y", "+Z", "-Z" };
+    const unsigned rsmSizes[]     = { 128, 256, 512, 1024, 2048 };
+    const char *   rsmSizeNames[] = { "128", "256", "512", "1024", "2048" };
+
+    // Settings the quality governor steps through, cheapest first
+    struct QualityLevel {
+        int      samples;
+        unsigned shadowSize;
+        float    renderScale;
+    };
+    const QualityLevel qualityLevels[] = { { 8, 256, 0.5f }, { 12, 256, 0.67f }, { 16, 512, 0.83f }, { 20, 512, 1.0f }, { 32, 512, 1.0f }, { 48, 512, 1.0f }, { 64, 1024, 1.0f }, { 96, 1024, 1.0f }, { 128, 1024, 1.0f }, { 200, 1024, 1.0f } };
+    const int          defaultQualityLevel = 3;
+
+    // std140 layout of the Frame block in rsm_phase2
+    struct FrameData {
+        glm::mat4 projection;
+        glm::mat4 view;
+        glm::vec3 lightPos;
+        float     farPlane;
+        glm::vec3 lightColor;
+        float     sampleRange;
+        glm::vec3 viewPos;
+        int32_t   sampleNum;
+        glm::vec2 sampleOffset;
+        int32_t   interleave;
+        float     indirectLightPower;
+        float     directLightPower;
+        uint32_t  disableDirectLight, disableIndirectLight, splitLighting;
+    };
+    static_assert(sizeof(FrameData) == 208);
+
+    // std140 layout of the Shadow block in rsm_phase1
+    struct ShadowData {
+        glm::mat4 shadowMatrices[6];
+        glm::vec3 lightPos;
+        float     farPlane;
+        glm::vec3 lightColor;
+        int32_t   faceMask;
+    };
+    static_assert(sizeof(ShadowData) == 416);
+
+    // A full screen pass for Renderer::blit. The blitted texture is bound as
+    // `source`, the other inputs are set by `uniforms` once the program is in use.
+    class PassMaterial final : public IMaterial {
+    public:
+        PassMaterial(RenderState & state, const char * fragFile):
+            _state(state), _program(Program::create_from_files("shaders/fullscreen.vert", fragFile)) {}
+
+        std::function<void(RenderState &)> uniforms;
+
+        void use() override {
+            _state.use_program(_program->get());
+            _state.bind_texture(0, GL_TEXTURE_2D, main_tex->get());
+            _state.set_uniform("source", 0);
+            if (uniforms) uniforms(_state);
+        }
+
+    private:
+        RenderState &            _state;
+        std::unique_ptr<Program> _program;
+    };
 
     class RSMApp final : public App {
     public:
-        RSMApp():
-            App("RSM DEMO", 1600, 1200) {}
+        explicit RSMApp(const LaunchOptions & options):
+            App("RSM DEMO", 1600, 1200, options) {}
 
     private:
-        const unsigned SCR_WIDTH = 1600, SCR_HEIGHT = 1200;
-        const unsigned SHADOW_SIZE = 512;
+        // time per frame spent creating GL objects for a scene being loaded
+        const float SCENE_UPLOAD_BUDGET_MS = 4.0f;
+        // the depth pyramid is reduced on the GPU until it fits this size,
+        // then read back for culling
+        const int HIZ_READBACK_SIZE = 128;
+        // draws per culling job
+        const size_t CULLING_GRAIN = 256;
+        // per frame room for the constant blocks of all passes
+        const size_t FRAME_CONSTANTS_SIZE = 16 << 10;
 
         glm::vec3 _pointLightIntensity { 1, 1, 1 };
         glm::vec3 _pointLightPosition;
 
         Scene _currentScene { Scene::DEBUG_SCENE };
+        Scene _loadingScene { Scene::DEBUG_SCENE };
 
-        std::unique_ptr<Gltf>        _scene;
-        std::unique_ptr<Program>     _program, _shadowProgram;
-        std::unique_ptr<FrameBuffer> _shadowFbo;
-        std::unique_ptr<Texture2D>   _randomMap;
-        std::unique_ptr<TextureCube> _depthMap, _normalMap, _fluxMap;
+        std::shared_ptr<Gltf>                    _scene;
+        std::unique_ptr<GltfLoader>              _sceneLoader;
+        std::vector<std::unique_ptr<GltfLoader>> _abandonedLoaders;
+        SceneCache                               _sceneCache { 512 << 20 };
+        int                                      _sceneCacheBudgetMb { 512 };
+        std::unique_ptr<Program>                 _program, _shadowProgram;
+        std::unique_ptr<ProgramPermutations>     _programVariants;
+        Program *                                _activeProgram {};
+        RenderState                              _state;
+        std::unique_ptr<FrameBuffer>             _shadowFbo;
+        std::unique_ptr<SampleSet>               _samples;
+        std::unique_ptr<TextureCube>             _depthMap, _normalMap, _fluxMap;
+        // the camera pass renders into the lower left part of these, sized
+        // like the window
+        std::unique_ptr<Texture2D>       _sceneColor, _sceneDepth;
+        std::unique_ptr<Framebuffer>     _sceneFbo;
+        std::unique_ptr<Renderer>        _renderer;
+        std::unique_ptr<RingBuffer>      _frameConstants;
+        std::unique_ptr<PassMaterial>    _upscale, _gather, _atrous, _composite;
+        bool                             _sceneTargetsDirty { true };
+        float                            _renderScale { qualityLevels[defaultQualityLevel].renderScale };
+        float                            _sharpness { 0.3f };
+        // split lighting of the camera pass and the denoiser's ping-pong
+        // targets, sized like the scene targets
+        std::unique_ptr<Texture2D>   _directLight, _indirectLight, _albedo, _normalDepth;
+        std::unique_ptr<Texture2D>   _filtered[2];
+        std::unique_ptr<Framebuffer> _lightingFbo, _filteredFbo[2];
+        bool                         _denoise { true };
+        // block size of interleaved sampling, 1 evaluates all samples per pixel
+        int                          _interleave { 1 };
+        int                          _denoiseIterations { 4 };
+        int                          _denoiseRadius { 1 };
+        float                        _denoiseDepthSigma { 0.05f };
+        float                        _denoiseNormalPower { 32.0f };
+        // max depth levels of the camera pass, halving from the window size
+        std::vector<std::unique_ptr<Texture2D>>   _hiz;
+        std::vector<std::unique_ptr<Framebuffer>> _hizFbo;
+        std::unique_ptr<PassMaterial>              _hizReduce;
+        std::unique_ptr<OcclusionCuller>           _occlusion;
+        bool                                       _occlusionCulling { true };
+        // instances that pass the test, grouped like the instance groups and
+        // fetched by the camera pass through _visibleTexture
+        const Gltf *                               _cullScene {};
+        std::vector<uint32_t>                      _visibleInstances;
+        std::vector<std::pair<uint32_t, uint32_t>> _visibleGroups; // first, count
+        std::vector<OcclusionCuller::Result>       _instanceResults;
+        std::unique_ptr<Buffer>                    _visibleBuffer;
+        std::unique_ptr<TextureBuffer>             _visibleTexture;
+        size_t                                     _drawsVisible {}, _drawsOutside {}, _drawsOccluded {};
+        // mip levels of the base color pages, requested by the visible draws
+        TextureStreamer _textureStreamer { 256 << 20 };
+        int             _textureBudgetMb { 256 };
 
         bool  _disableDirectLight { false };
         bool  _disableIndirectLight { false };
         float _directLightPower { 1.0 };
         float _indirectLightPower { 1.3 };
 
-        float _sampleRange { 0.6 };
-        int   _sampleNum { 20 };
+        float         _sampleRange { 0.6 };
+        SamplePattern _samplePattern { SamplePattern::Sobol };
+        bool          _scrambleSamples { false };
+        int           _sampleNum { qualityLevels[defaultQualityLevel].samples };
+
+        bool            _autoQuality { false };
+        QualityGovernor _governor { IM_ARRAYSIZE(qualityLevels), defaultQualityLevel };
+        uint64_t        _governedFrame { 0 };
+
+        int    _animation { 0 };
+        bool   _playAnimation { true };
+        float  _animationTime { 0 };
+        float  _animationSpeed { 1 };
+        size_t _movedDraws { 0 };
+
+        // inputs of the last shadow pass, it is only redrawn when they change
+        bool        _shadowDirty { true };
+        const Gltf * _shadowScene {};
+        glm::vec3   _shadowLightPosition, _shadowLightIntensity;
+
+        unsigned _shadowSize { qualityLevels[defaultQualityLevel].shadowSize };
+        // GL_MAX_CUBE_MAP_TEXTURE_SIZE, 3.3 only guarantees 1024
+        unsigned _maxShadowSize { 1024 };
+        int      _shadowFormat { 1 };
+        int      _shadowFaceMask { 0x3f };
+        // first frame rendered with the current shadow map settings
+        uint64_t _shadowSince { 0 };
+        uint64_t _shadowMeasuredFrame { 0 };
+        // average GPU time of the shadow pass per (size, format, faces)
+        std::map<std::tuple<unsigned, int, int>, float> _shadowCosts;
+
+        int  _captureEvery { 1 };
+        bool _showTimings { false };
+        bool _showPacing { false };
 
     private:
         void init() override {
             loadScene(_currentScene);
 
-            _program       = Program::create_from_files("shaders/rsm_phase2.vert", "shaders/rsm_phase2.frag");
-            _shadowProgram = Program::create_from_files("shaders/rsm_phase1.vert", "shaders/rsm_phase1.geom", "shaders/rsm_phase1.frag");
+            _program         = Program::create_from_files("shaders/rsm_phase2.vert", "shaders/rsm_phase2.frag");
+            _programVariants = std::make_unique<ProgramPermutations>("shaders/rsm_phase2.vert", "shaders/rsm_phase2.frag", shader_compiler());
+            _shadowProgram   = Program::create_from_files("shaders/rsm_phase1.vert", "shaders/rsm_phase1.geom", "shaders/rsm_phase1.frag");
 
-            _shadowFbo = std::make_unique<FrameBuffer>();
+            _samples   = std::make_unique<SampleSet>(_samplePattern, _sampleNum);
+            _renderer  = std::make_unique<Renderer>();
+            _upscale   = std::make_unique<PassMaterial>(_state, "shaders/upscale.frag");
+            _gather    = std::make_unique<PassMaterial>(_state, "shaders/gather.frag");
+            _atrous    = std::make_unique<PassMaterial>(_state, "shaders/atrous.frag");
+            _composite = std::make_unique<PassMaterial>(_state, "shaders/composite.frag");
+            _hizReduce = std::make_unique<PassMaterial>(_state, "shaders/hiz.frag");
+            _occlusion = std::make_unique<OcclusionCuller>();
 
-            _randomMap = std::make_unique<Texture2D>("images/random_map.png");
+            auto & options = launch_options();
+            auto   invalid = [&](const char * name, const std::string & expected) {
+                return std::runtime_error("invalid --set " + std::string(name) + "=" + options.setting(name, "") + ", expected " + expected + "\n" + LaunchOptions::usage());
+            };
+            auto ringBuffer = options.setting("ring-buffer", "persistent");
+            if (ringBuffer != "persistent" && ringBuffer != "orphan") {
+                throw invalid("ring-buffer", "persistent or orphan");
+            }
+            _frameConstants = std::make_unique<RingBuffer>(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_SIZE, FramePacer::MAX_FRAMES_IN_FLIGHT, ringBuffer == "persistent");
+            // only the sizes, formats and faces the UI offers
+            auto size = std::find(std::begin(rsmSizeNames), std::end(rsmSizeNames), options.setting("rsm-size", std::to_string(_shadowSize)));
+            if (size == std::end(rsmSizeNames)) {
+                std::string sizes;
+                for (auto * name : rsmSizeNames) sizes += (sizes.empty() ? "" : ", ") + std::string(name);
+                throw invalid("rsm-size", "one of " + sizes);
+            }
+            GLint maxCubeSize = 0;
+            glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxCubeSize);
+            _maxShadowSize = (unsigned) maxCubeSize;
+            _shadowSize    = rsmSizes[size - std::begin(rsmSizeNames)];
+            if (_shadowSize > _maxShadowSize) {
+                throw invalid("rsm-size", "at most " + std::to_string(_maxShadowSize) + " on this GPU");
+            }
+            auto format      = options.setting("rsm-format", std::to_string(_shadowFormat));
+            int  formatIndex = -1;
+            for (int i = 0; i < IM_ARRAYSIZE(rsmFormats); i++) {
+                if (format == std::to_string(i)) formatIndex = i;
+            }
+            if (formatIndex < 0) {
+                throw invalid("rsm-format", "0 to " + std::to_string(IM_ARRAYSIZE(rsmFormats) - 1));
+            }
+            _shadowFormat = formatIndex;
+            // two characters per face, each face at most once
+            auto faces      = options.setting("rsm-faces", "+X-X+Y-Y+Z-Z");
+            _shadowFaceMask = 0;
+            for (size_t i = 0; i < faces.size(); i += 2) {
+                auto face = std::find(std::begin(rsmFaceNames), std::end(rsmFaceNames), faces.substr(i, 2));
+                int  bit  = 1 << (face - std::begin(rsmFaceNames));
+                if (face == std::end(rsmFaceNames) || (_shadowFaceMask & bit) != 0) {
+                    throw invalid("rsm-faces", "a combination of +X -X +Y -Y +Z -Z");
+                }
+                _shadowFaceMask |= bit;
+            }
+            if (_shadowFaceMask == 0) {
+                throw invalid("rsm-faces", "a combination of +X -X +Y -Y +Z -Z");
+            }
+            createShadowMaps();
+        }
 
-            _depthMap  = std::make_unique<TextureCube>(SHADOW_SIZE, GL_FLOAT, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT);
-            _fluxMap   = std::make_unique<TextureCube>(SHADOW_SIZE, GL_FLOAT, GL_RGB, GL_RGB);
-            _normalMap = std::make_unique<TextureCube>(SHADOW_SIZE, GL_FLOAT, GL_RGB, GL_RGB);
+        // (Re)creates the cube maps and the framebuffer for the current
+        // shadow map size and format
+        void createShadowMaps() {
+            auto & format = rsmFormats[_shadowFormat];
+            _depthMap     = std::make_unique<TextureCube>(_shadowSize, GL_FLOAT, GL_DEPTH_COMPONENT, format.depth);
+            _fluxMap      = std::make_unique<TextureCube>(_shadowSize, GL_FLOAT, GL_RGB, format.color);
+            _normalMap    = std::make_unique<TextureCube>(_shadowSize, GL_FLOAT, GL_RGB, format.color);
+            // a new framebuffer rather than re-attaching, the old one is
+            // deleted along with the previous maps
+            _shadowFbo = std::make_unique<FrameBuffer>();
+            _state.invalidate();
 
             glBindFramebuffer(GL_FRAMEBUFFER, _shadowFbo->get());
             glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _depthMap->get(), 0);
@@ -74,9 +320,126 @@ namespace rsm {
                 exit(1);
             }
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            _shadowDirty = true;
+            _shadowSince = frame_timings().current_frame();
+        }
+
+        void resize_callback(int width, int height) override {
+            App::resize_callback(width, height);
+            _sceneTargetsDirty = true;
+        }
+
+        // The targets only follow the window size, the render scale picks
+        // the part of them that is used so it can change every frame
+        void createSceneTargets() {
+            _sceneTargetsDirty = false;
+            auto width         = std::max(getWidth(), 1);
+            auto height        = std::max(getHeight(), 1);
+            TextureSettings settings;
+            settings.wrap_s     = GL_CLAMP_TO_EDGE;
+            settings.wrap_t     = GL_CLAMP_TO_EDGE;
+            settings.min_filter = GL_LINEAR;
+            settings.mipmaps    = false;
+            _sceneColor         = std::make_unique<Texture2D>(nullptr, GL_UNSIGNED_BYTE, width, height, GL_RGBA8, GL_RGBA, &settings);
+            settings.min_filter = GL_NEAREST;
+            settings.max_filter = GL_NEAREST;
+            _sceneDepth         = std::make_unique<Texture2D>(nullptr, GL_UNSIGNED_INT_24_8, width, height, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, &settings);
+            Texture2D * colors[] = { _sceneColor.get() };
+            _sceneFbo            = std::make_unique<Framebuffer>(colors, 1, _sceneDepth.get());
+
+            // the denoiser reads exact texels, nothing is filtered
+            auto target = [&](GLenum internalFormat, GLenum type) {
+                return std::make_unique<Texture2D>(nullptr, type, width, height, internalFormat, GL_RGBA, &settings);
+            };
+            _directLight            = target(GL_RGBA16F, GL_FLOAT);
+            _indirectLight          = target(GL_RGBA16F, GL_FLOAT);
+            _albedo                 = target(GL_RGBA8, GL_UNSIGNED_BYTE);
+            _normalDepth            = target(GL_RGBA16F, GL_FLOAT);
+            Texture2D * lighting[]  = { _directLight.get(), _indirectLight.get(), _albedo.get(), _normalDepth.get() };
+            _lightingFbo            = std::make_unique<Framebuffer>(lighting, 4, _sceneDepth.get());
+            for (int i = 0; i < 2; i++) {
+                _filtered[i]           = target(GL_RGBA16F, GL_FLOAT);
+                Texture2D * filtered[] = { _filtered[i].get() };
+                _filteredFbo[i]        = std::make_unique<Framebuffer>(filtered, 1, nullptr);
+            }
+
+            _hiz.clear();
+            _hizFbo.clear();
+            for (auto size = glm::ivec2(width, height); size.x > 1 || size.y > 1;) {
+                size              = (size + 1) / 2;
+                Texture2D * hiz[] = { _hiz.emplace_back(std::make_unique<Texture2D>(nullptr, GL_FLOAT, size.x, size.y, GL_R32F, GL_RED, &settings)).get() };
+                _hizFbo.push_back(std::make_unique<Framebuffer>(hiz, 1, nullptr));
+            }
+            _state.invalidate();
+        }
+
+        // The gather and the denoiser need the lighting split into targets
+        bool splitLighting() const {
+            return _denoise || _interleave > 1;
+        }
+
+        glm::ivec2 renderSize() const {
+            return glm::max(glm::ivec2(glm::round(glm::vec2(getWidth(), getHeight()) * _renderScale)), glm::ivec2(1));
+        }
+
+        size_t shadowMapBytes() const {
+            auto & format = rsmFormats[_shadowFormat];
+            return (size_t) _shadowSize * _shadowSize * 6 * (2 * format.colorBytes + format.depthBytes);
+        }
+
+        // Keeps a running average of the shadow pass per setting, from the
+        // frames that were rendered with it
+        void measureShadowPass() {
+            auto & timings = frame_timings();
+            auto   frame   = timings.resolved_frame();
+            if (frame == _shadowMeasuredFrame || frame < _shadowSince) return;
+            _shadowMeasuredFrame = frame;
+            auto ms              = timings.pass_gpu_ms(frame, "RSM");
+            if (ms <= 0.0f) return;
+            auto & cost = _shadowCosts[{ _shadowSize, _shadowFormat, _shadowFaceMask }];
+            cost        = cost == 0.0f ? ms : cost + 0.1f * (ms - cost);
         }
 
         void loadScene(Scene scene) {
+            _scene = std::make_shared<Gltf>(scenePaths[scene], &_sceneCache);
+            _sceneCache.insert(scenePaths[scene], _scene);
+            applySceneView(scene);
+        }
+
+        // The current scene keeps rendering until the new one is uploaded.
+        void requestScene(Scene scene) {
+            if (_sceneLoader) {
+                // destroying a loader waits for its jobs, so let them finish first
+                _abandonedLoaders.push_back(std::move(_sceneLoader));
+            }
+            if (auto cached = _sceneCache.find(scenePaths[scene])) {
+                _scene        = cached;
+                _currentScene = scene;
+                applySceneView(scene);
+                return;
+            }
+            _sceneLoader  = std::make_unique<GltfLoader>(scenePaths[scene], &_sceneCache);
+            _loadingScene = scene;
+        }
+
+        void updateSceneLoad() {
+            std::erase_if(_abandonedLoaders, [](auto & loader) { return loader->idle(); });
+            if (! _sceneLoader) return;
+            try {
+                if (_sceneLoader->step(SCENE_UPLOAD_BUDGET_MS)) {
+                    _scene = _sceneLoader->take();
+                    _sceneLoader.reset();
+                    _sceneCache.insert(scenePaths[_loadingScene], _scene);
+                    _currentScene = _loadingScene;
+                    applySceneView(_currentScene);
+                }
+            } catch (std::exception & e) {
+                std::cerr << e.what() << std::endl;
+                _sceneLoader.reset();
+            }
+        }
+
+        void applySceneView(Scene scene) {
             camera::Sphere viewSphere;
             viewSphere.radius = 5.0f;
             viewSphere.theta  = PI / 2.0f;
@@ -84,17 +447,14 @@ namespace rsm {
 
             switch (scene) {
             case Scene::DEBUG_SCENE:
-                _scene              = std::make_unique<Gltf>("models/debug_scene/scene.gltf");
                 target              = glm::vec3(1, 1, -1);
                 _pointLightPosition = glm::vec3(1, 1.6, -1);
                 break;
             case Scene::CORNELL_BOX:
-                _scene              = std::make_unique<Gltf>("models/cornell_box/scene.gltf");
                 target              = glm::vec3(0, 1, 0);
                 _pointLightPosition = glm::vec3(0, 1.6, 0);
                 break;
             case Scene::FLIGHT_HELMET:
-                _scene              = std::make_unique<Gltf>("models/flight_helmet/scene.gltf");
                 target              = glm::vec3(0, 0.2, 0);
                 viewSphere.radius   = 2.0f;
                 _pointLightPosition = glm::vec3(0, 1.6, 1.6);
@@ -106,39 +466,399 @@ namespace rsm {
 
         void update() override {
             App::update();
+            updateSceneLoad();
+            updateAnimation();
+            updateQuality();
+            measureShadowPass();
             drawui();
+            selectProgram();
+            updateCulling();
+            updateStreaming();
             render();
         }
 
+        void updateAnimation() {
+            _movedDraws = 0;
+            if (_scene->animations.empty()) return;
+            _animation = std::min(_animation, (int) _scene->animations.size() - 1);
+            if (_playAnimation) {
+                _animationTime += getDelta() * _animationSpeed;
+                _scene->animate(_animation, _animationTime);
+            }
+            _movedDraws = _scene->update_transforms().size();
+            if (_movedDraws > 0) {
+                _shadowDirty = true;
+            }
+        }
+
+        // Tests every draw against the view and the newest depth pyramid and
+        // lists the instances that pass per instance group
+        void updateCulling() {
+            MICROPROFILE_SCOPEI("RSM", "Culling", 0x5e6472);
+            if (_scene.get() != _cullScene) {
+                _cullScene = _scene.get();
+                _occlusion->reset();
+                auto instances = std::max<size_t>(_scene->draws.size(), 1);
+                _visibleBuffer  = std::make_unique<Buffer>(nullptr, instances * sizeof(uint32_t), GL_STREAM_DRAW);
+                _visibleTexture = std::make_unique<TextureBuffer>(GL_R32UI, _visibleBuffer->get());
+                _state.invalidate();
+            }
+            _occlusion->update();
+
+            auto viewProjection = _camera.getProjectionMatrix(getAspect()) * _camera.getViewMatrix();
+            _instanceResults.assign(_scene->draws.size(), OcclusionCuller::Result::Visible);
+            if (_occlusionCulling) {
+                // the tests only read the scene and the pyramid
+                JobSystem::instance().parallel_for(0, _scene->draws.size(), CULLING_GRAIN, [&](size_t first, size_t last) {
+                    for (auto draw = (uint32_t) first; draw < last; draw++) {
+                        auto bounds = _scene->draw_bounds(draw);
+                        _instanceResults[_scene->draw_instances[draw]] = _occlusion->test(bounds.min, bounds.max, viewProjection);
+                    }
+                });
+            }
+            _drawsVisible  = std::count(_instanceResults.begin(), _instanceResults.end(), OcclusionCuller::Result::Visible);
+            _drawsOutside  = std::count(_instanceResults.begin(), _instanceResults.end(), OcclusionCuller::Result::Outside);
+            _drawsOccluded = std::count(_instanceResults.begin(), _instanceResults.end(), OcclusionCuller::Result::Occluded);
+
+            _visibleInstances.clear();
+            _visibleGroups.clear();
+            for (auto & group : _scene->instance_groups) {
+                auto first = (uint32_t) _visibleInstances.size();
+                for (auto instance = group.first_instance; instance < group.first_instance + group.instance_count; instance++) {
+                    if (_instanceResults[instance] == OcclusionCuller::Result::Visible) _visibleInstances.push_back(instance);
+                }
+                _visibleGroups.emplace_back(first, (uint32_t) _visibleInstances.size() - first);
+            }
+            if (! _visibleInstances.empty()) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, _visibleBuffer->get());
+                glBufferSubData(GL_COPY_WRITE_BUFFER, 0, _visibleInstances.size() * sizeof(uint32_t), _visibleInstances.data());
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            }
+        }
+
+        // Requests the mip levels the draws that passed culling need at the
+        // current render size. Runs before the frame's GL state is tracked,
+        // streaming recreates page textures.
+        void updateStreaming() {
+            MICROPROFILE_SCOPEI("RSM", "Streaming", 0xf4a261);
+            _textureStreamer.begin_frame(*_scene);
+            auto eye        = _camera.getPosition();
+            auto pixelScale = renderSize().y * _camera.getProjectionMatrix(getAspect())[1][1] * 0.5f;
+            for (uint32_t draw = 0; draw < _scene->draws.size(); draw++) {
+                if (_instanceResults[_scene->draw_instances[draw]] == OcclusionCuller::Result::Visible) {
+                    _textureStreamer.request(*_scene, draw, eye, pixelScale);
+                }
+            }
+            if (_textureStreamer.update(*_scene)) {
+                // the flux of the shadow map samples the pages too
+                _shadowDirty = true;
+            }
+        }
+
+        // Reduces the camera pass depth on the GPU and queues a readback of
+        // the first level that is small enough
+        void buildDepthPyramid(const glm::mat4 & viewProjection) {
+            if (_hiz.empty()) return;
+            auto   size      = renderSize();
+            auto   source    = _sceneDepth.get();
+            int    texelSize = 1;
+            size_t level     = 0;
+            do {
+                auto sourceSize = size;
+                size            = (size + 1) / 2;
+                texelSize *= 2;
+                glViewport(0, 0, size.x, size.y);
+                _state.bind_framebuffer(_hizFbo[level]->get());
+                _hizReduce->uniforms = [&](RenderState & state) {
+                    state.set_uniform("sourceSize", glm::vec2(sourceSize));
+                };
+                _renderer->blit(_state, source, _hizReduce.get());
+                source = _hiz[level].get();
+                level++;
+            } while (std::max(size.x, size.y) > HIZ_READBACK_SIZE && level < _hiz.size());
+            _occlusion->read(size.x, size.y, texelSize, renderSize(), viewProjection);
+            // the split lighting passes that follow draw at the render size
+            glViewport(0, 0, renderSize().x, renderSize().y);
+        }
+
+        // Feeds each frame's GPU time to the governor once its queries resolve
+        void updateQuality() {
+            if (! _autoQuality) return;
+            auto & timings = frame_timings();
+            auto   frame   = timings.resolved_frame();
+            if (frame == _governedFrame) return;
+            _governedFrame = frame;
+            if (_governor.update(frame, timings.gpu_frame_ms(frame))) {
+                applyQuality(_governor.level());
+            }
+        }
+
+        void applyQuality(int level) {
+            _sampleNum   = qualityLevels[level].samples;
+            _renderScale = qualityLevels[level].renderScale;
+            auto size    = std::min(qualityLevels[level].shadowSize, _maxShadowSize);
+            if (_shadowSize != size) {
+                _shadowSize = size;
+                createShadowMaps();
+            }
+        }
+
+        // Length of the sequence the camera pass reads, each pixel of an
+        // interleave block owns the next power of two of its share
+        size_t sampleSetSize() const {
+            int interleave = splitLighting() ? _interleave : 1;
+            int block      = interleave * interleave;
+            return (size_t) block * std::bit_ceil((unsigned) (_sampleNum + block - 1) / block);
+        }
+
+        // The generic program is used until the permutation specialized for
+        // the current toggles and sample count bucket has been built. The
+        // bucket bounds the gather loop, its exit only becomes static when
+        // every pixel takes exactly the bucket's samples.
+        void selectProgram() {
+            // interleaving spreads the samples over the block
+            int      interleave = splitLighting() ? _interleave : 1;
+            unsigned perPixel   = (unsigned) (_sampleNum + interleave * interleave - 1) / (interleave * interleave);
+            unsigned bucket     = 8;
+            while (bucket < perPixel) bucket *= 2;
+            ShaderDefines defines {
+                { "DIRECT_LIGHT", _disableDirectLight ? "false" : "true" },
+                { "INDIRECT_LIGHT", _disableIndirectLight ? "false" : "true" },
+                { "SPLIT_LIGHTING", splitLighting() ? "true" : "false" },
+                { "SAMPLE_NUM_MAX", std::to_string(bucket) },
+                { "SAMPLE_NUM_EXACT", (unsigned) _sampleNum == bucket * interleave * interleave ? "true" : "false" },
+            };
+            _programVariants->poll();
+            _activeProgram = _programVariants->get(defines);
+            if (_activeProgram == nullptr) {
+                _activeProgram = _program.get();
+            }
+        }
+
         void drawui() {
             ImGui::Checkbox("Fix camera", &_disableControl);
             ImGui::Text("FPS: %.1f", 1.0f / App::getDelta());
-            int currentScene = static_cast<int>(_currentScene);
+            ImGui::Checkbox("Frame Timings", &_showTimings);
+            if (_showTimings) {
+                frame_timings().draw_overlay(&_showTimings);
+            }
+            ImGui::Checkbox("Frame Pacing", &_showPacing);
+            if (_showPacing) {
+                frame_pacer().draw_timeline(&_showPacing);
+            }
+            int currentScene = static_cast<int>(_sceneLoader ? _loadingScene : _currentScene);
             if (ImGui::Combo("Select Scene", &currentScene, sceneNames, IM_ARRAYSIZE(sceneNames))) {
-                _currentScene = static_cast<Scene>(currentScene);
-                loadScene(_currentScene);
+                requestScene(static_cast<Scene>(currentScene));
+            }
+            if (_sceneLoader) {
+                ImGui::ProgressBar(_sceneLoader->progress(), ImVec2(-1, 0), _sceneLoader->staged() ? "Uploading" : "Parsing");
+            }
+            if (ImGui::CollapsingHeader("Scene Cache")) {
+                if (ImGui::SliderInt("Budget (MB)", &_sceneCacheBudgetMb, 0, 2048)) {
+                    _sceneCache.set_budget((size_t) _sceneCacheBudgetMb << 20);
+                }
+                auto stats = _sceneCache.stats();
+                ImGui::Text("Hits: %llu, misses: %llu, evictions: %llu", (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+                ImGui::Text("Resident: %zu scenes, GPU %.1f MB, CPU %.1f MB", stats.resident_scenes, stats.gpu_bytes / 1048576.0f, stats.cpu_bytes / 1048576.0f);
+                ImGui::Text("Process: %.1f MB, peak %.1f MB", resident_bytes() / 1048576.0f, peak_resident_bytes() / 1048576.0f);
             }
 
             if (ImGui::CollapsingHeader("RSM Settings", ImGuiTreeNodeFlags_DefaultOpen)) {
                 ImGui::SliderFloat("Sample Range", &_sampleRange, 0.0f, 1.6f, "%.2f");
-                ImGui::SliderInt("Sample Number", &_sampleNum, 0, 600);
+                auto getPattern = [](void *, int index, const char ** name) {
+                    *name = sample_pattern_name(static_cast<SamplePattern>(index));
+                    return true;
+                };
+                int pattern = static_cast<int>(_samplePattern);
+                if (ImGui::Combo("Sample Pattern", &pattern, getPattern, nullptr, 4)) {
+                    _samplePattern = static_cast<SamplePattern>(pattern);
+                }
+                ImGui::Checkbox("Scramble Per Frame", &_scrambleSamples);
+                if (ImGui::SliderInt("Sample Number", &_sampleNum, 0, 1024)) {
+                    // a manual choice overrides the governor
+                    _autoQuality = false;
+                }
+                static const char * interleaveNames[] = { "Off", "2x2", "3x3", "4x4" };
+                int                 interleaveIndex   = _interleave - 1;
+                if (ImGui::Combo("Interleave", &interleaveIndex, interleaveNames, IM_ARRAYSIZE(interleaveNames))) {
+                    _interleave = interleaveIndex + 1;
+                }
+                if (_interleave > 1) {
+                    ImGui::Text("%d samples per pixel", (_sampleNum + _interleave * _interleave - 1) / (_interleave * _interleave));
+                }
                 ImGui::SliderFloat("Direct Factor", &_directLightPower, 0.0f, 4.0f, "%.2f");
                 ImGui::SliderFloat("Indirect Factor", &_indirectLightPower, 0.0f, 10.0f, "%.2f");
                 ImGui::Checkbox("Mask Direct Light", &_disableDirectLight);
                 ImGui::Checkbox("Mask Indirect Light", &_disableIndirectLight);
+                auto calls = _state.last_frame();
+                ImGui::Text("GL calls: %llu issued, %llu skipped", (unsigned long long) calls.issued, (unsigned long long) calls.skipped);
+                ImGui::Text("Shader: %s (%zu pending)", _activeProgram == _program.get() ? "generic" : "specialized", _programVariants->pending());
+                auto constants = _frameConstants->stats();
+                ImGui::Text("Constants: %s, %zu bytes per frame, %llu waits (%.1f ms)", _frameConstants->persistent() ? "persistent map" : "orphaned", constants.peak_bytes, (unsigned long long) constants.waits, constants.wait_ms);
+            }
+            if (ImGui::CollapsingHeader("Resolution")) {
+                if (ImGui::SliderFloat("Render Scale", &_renderScale, 0.25f, 1.0f, "%.2f")) {
+                    _autoQuality = false;
+                }
+                ImGui::SliderFloat("Sharpness", &_sharpness, 0.0f, 1.0f, "%.2f");
+                auto size = renderSize();
+                ImGui::Text("%d x %d, upscaled to %d x %d", size.x, size.y, getWidth(), getHeight());
+            }
+            if (ImGui::CollapsingHeader("Denoiser")) {
+                ImGui::Checkbox("Enabled##denoise", &_denoise);
+                ImGui::SliderInt("Iterations", &_denoiseIterations, 0, 5);
+                ImGui::SliderInt("Step", &_denoiseRadius, 1, 4);
+                ImGui::SliderFloat("Depth Sigma", &_denoiseDepthSigma, 0.001f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+                ImGui::SliderFloat("Normal Power", &_denoiseNormalPower, 1.0f, 128.0f, "%.0f");
+                // each iteration doubles the spacing of the 5x5 kernel taps
+                ImGui::Text("Filter radius: %d px", 2 * _denoiseRadius * ((1 << _denoiseIterations) - 1));
+            }
+            if (ImGui::CollapsingHeader("Occlusion Culling")) {
+                if (ImGui::Checkbox("Enabled##culling", &_occlusionCulling)) {
+                    // the pyramid stopped following the view while disabled
+                    _occlusion->reset();
+                }
+                ImGui::Text("Draws: %zu visible, %zu outside the view, %zu occluded", _drawsVisible, _drawsOutside, _drawsOccluded);
+                ImGui::Text("Depth pyramid: %s", _occlusion->ready() ? "ready" : "waiting for readback");
+            }
+            if (ImGui::CollapsingHeader("Texture Streaming")) {
+                if (ImGui::SliderInt("Budget (MB)##streaming", &_textureBudgetMb, 0, 1024)) {
+                    _textureStreamer.set_budget((size_t) _textureBudgetMb << 20);
+                }
+                auto stats = _textureStreamer.stats();
+                ImGui::Text("Resident: %.1f MB, %llu levels streamed in, %llu dropped", stats.resident_bytes / 1048576.0f, (unsigned long long) stats.uploads, (unsigned long long) stats.evictions);
+                // the streamer catches up with a new scene in updateStreaming()
+                auto & pages = _textureStreamer.pages();
+                if (! pages.empty() && pages.size() == _scene->page_sources.size() && ImGui::BeginTable("streamed textures", 4, ImGuiTableFlags_Borders)) {
+                    ImGui::TableSetupColumn("Texture");
+                    ImGui::TableSetupColumn("Page");
+                    ImGui::TableSetupColumn("Resident");
+                    ImGui::TableSetupColumn("Wanted");
+                    ImGui::TableHeadersRow();
+                    for (size_t i = 0; i < pages.size(); i++) {
+                        auto & source = _scene->page_sources[i];
+                        for (size_t layer = 0; layer < source.textures.size(); layer++) {
+                            ImGui::TableNextRow();
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%d", source.textures[layer]);
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%zu/%zu", i, layer);
+                            ImGui::TableNextColumn();
+                            ImGui::Text("mip %d, %d x %d", source.resident_level, std::max(source.width >> source.resident_level, 1), std::max(source.height >> source.resident_level, 1));
+                            ImGui::TableNextColumn();
+                            ImGui::Text("mip %d", pages[i].wanted);
+                        }
+                    }
+                    ImGui::EndTable();
+                }
+            }
+            if (ImGui::CollapsingHeader("Shadow Map")) {
+                int sizeIndex = 0;
+                while (sizeIndex + 1 < IM_ARRAYSIZE(rsmSizes) && rsmSizes[sizeIndex] < _shadowSize) sizeIndex++;
+                bool changed = false;
+                // sizes above the cube map limit are shown but disabled
+                if (ImGui::BeginCombo("Size", rsmSizeNames[sizeIndex])) {
+                    for (int i = 0; i < IM_ARRAYSIZE(rsmSizes); i++) {
+                        auto flags = rsmSizes[i] > _maxShadowSize ? ImGuiSelectableFlags_Disabled : ImGuiSelectableFlags_None;
+                        if (ImGui::Selectable(rsmSizeNames[i], i == sizeIndex, flags) && i != sizeIndex) {
+                            _shadowSize  = rsmSizes[i];
+                            _autoQuality = false;
+                            changed      = true;
+                        }
+                    }
+                    ImGui::EndCombo();
+                }
+                auto getFormat = [](void *, int index, const char ** name) {
+                    *name = rsmFormats[index].name;
+                    return true;
+                };
+                changed |= ImGui::Combo("Format", &_shadowFormat, getFormat, nullptr, IM_ARRAYSIZE(rsmFormats));
+                if (changed) createShadowMaps();
+                for (int i = 0; i < 6; i++) {
+                    if (i > 0) ImGui::SameLine();
+                    _shadowDirty |= ImGui::CheckboxFlags(rsmFaceNames[i], &_shadowFaceMask, 1 << i);
+                }
+                ImGui::Text("%u x %u x 6, %.1f MB", _shadowSize, _shadowSize, shadowMapBytes() / 1048576.0f);
+                if (ImGui::BeginTable("shadow costs", 3, ImGuiTableFlags_Borders)) {
+                    ImGui::TableSetupColumn("Setting");
+                    ImGui::TableSetupColumn("MB");
+                    ImGui::TableSetupColumn("GPU ms");
+                    ImGui::TableHeadersRow();
+                    for (auto & [setting, ms] : _shadowCosts) {
+                        auto [size, format, faceMask] = setting;
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%u, %s, %d faces", size, rsmFormats[format].name, std::popcount((unsigned) faceMask));
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.1f", (size_t) size * size * 6 * (2 * rsmFormats[format].colorBytes + rsmFormats[format].depthBytes) / 1048576.0f);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.2f", ms);
+                    }
+                    ImGui::EndTable();
+                }
+            }
+            if (ImGui::CollapsingHeader("Auto Quality")) {
+                if (ImGui::Checkbox("Enabled", &_autoQuality) && _autoQuality) {
+                    _governor.set_level(_governor.level());
+                    applyQuality(_governor.level());
+                }
+                auto & settings = _governor.settings;
+                ImGui::SliderFloat("Target GPU (ms)", &settings.target_ms, 2.0f, 50.0f, "%.1f");
+                ImGui::SliderFloat("Headroom", &settings.headroom, 0.5f, 0.95f, "%.2f");
+                ImGui::SliderInt("Raise After (frames)", &settings.raise_after, 1, 240);
+                auto & level = qualityLevels[_governor.level()];
+                ImGui::Text("Level %d/%d, %d samples, RSM %u, scale %.2f, GPU %.2f ms", _governor.level(), _governor.levels() - 1, level.samples, level.shadowSize, level.renderScale, _governor.smoothed_ms());
+                auto & decisions = _governor.decisions();
+                for (size_t i = decisions.size(); i-- > 0;) {
+                    auto & decision = decisions[i];
+                    ImGui::Text("frame %llu: %d -> %d at %.2f ms", (unsigned long long) decision.frame, decision.from, decision.to, decision.gpu_ms);
+                }
             }
             if (ImGui::CollapsingHeader("Light", ImGuiTreeNodeFlags_DefaultOpen)) {
                 ImGui::SliderFloat3("Light Position", glm::value_ptr(_pointLightPosition), -2, 2, "%.2f");
                 ImGui::SliderFloat3("Light Intensity", glm::value_ptr(_pointLightIntensity), 0, 10, "%.2f");
             }
+            if (! _scene->animations.empty() && ImGui::CollapsingHeader("Animation")) {
+                auto getName = [](void * data, int index, const char ** name) {
+                    auto & animation = static_cast<Gltf *>(data)->animations[index];
+                    *name = animation.name.empty() ? "(unnamed)" : animation.name.c_str();
+                    return true;
+                };
+                ImGui::Combo("Clip", &_animation, getName, _scene.get(), (int) _scene->animations.size());
+                ImGui::Checkbox("Play", &_playAnimation);
+                ImGui::SliderFloat("Speed", &_animationSpeed, 0.0f, 4.0f, "%.2f");
+                ImGui::Text("Moved draws: %zu of %zu", _movedDraws, _scene->draws.size());
+            }
+            if (ImGui::CollapsingHeader("Capture")) {
+                auto & capture = frame_capture();
+                if (ImGui::Button("Screen Shot")) {
+                    request_screen_shot();
+                }
+                ImGui::SliderInt("Every Nth Frame", &_captureEvery, 1, 60);
+                bool recording = capture.sequence_active();
+                if (ImGui::Checkbox("Record Sequence", &recording)) {
+                    if (recording) {
+                        capture.start_sequence("ogl-capture", _captureEvery);
+                    } else {
+                        capture.stop_sequence();
+                    }
+                }
+                auto stats = capture.stats();
+                ImGui::Text("Queue: %zu readback, %zu encode", stats.pending_readbacks, stats.queued_encodes);
+                ImGui::Text("Written: %llu, dropped: %llu, failed: %llu", (unsigned long long) stats.frames_written, (unsigned long long) stats.frames_dropped, (unsigned long long) stats.frames_failed);
+                ImGui::Text("Encode: %.1f ms/frame, %.1f MB/s", stats.encode_ms, stats.encode_mb_per_sec);
+            }
             if (ImGui::CollapsingHeader("Hint")) {
                 ImGui::TextWrapped(
                     "1. `Press QWEASD` and `Drag screen` to adjust the camera view.\n"
-                    "3. Reduce the `Sample Number` to improve the frame rate.");
+                    "3. Reduce the `Sample Number` or enable `Auto Quality` to improve the frame rate.");
             }
         }
 
         void render() {
+            // ImGui and resource uploads have touched GL state since the last frame
+            _state.begin_frame();
+            _frameConstants->begin_frame();
             glEnable(GL_DEPTH_TEST);
             glEnable(GL_CULL_FACE);
 
@@ -154,88 +874,198 @@ namespace rsm {
             shadowTransforms.push_back(shadowProj * glm::lookAt(_pointLightPosition, _pointLightPosition + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0)));
             shadowTransforms.push_back(shadowProj * glm::lookAt(_pointLightPosition, _pointLightPosition + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0)));
             shadowTransforms.push_back(shadowProj * glm::lookAt(_pointLightPosition, _pointLightPosition + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0)));
-            // RenderScene
-            glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE);
-            glBindFramebuffer(GL_FRAMEBUFFER, _shadowFbo->get());
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            glUseProgram(_shadowProgram->get());
-            for (GLuint i = 0; i < 6; ++i)
-                glUniformMatrix4fv(glGetUniformLocation(_shadowProgram->get(), ("shadowMatrices[" + std::to_string(i) + "]").c_str()), 1, GL_FALSE, glm::value_ptr(shadowTransforms[i]));
-            glUniform3fv(glGetUniformLocation(_shadowProgram->get(), "lightPos"), 1, glm::value_ptr(_pointLightPosition));
-            glUniform3fv(glGetUniformLocation(_shadowProgram->get(), "lightColor"), 1, glm::value_ptr(_pointLightIntensity));
-            glUniform1f(glGetUniformLocation(_shadowProgram->get(), "far_plane"), far);
-            for (auto & draw : _scene->draws) {
-                glUniformMatrix4fv(glGetUniformLocation(_shadowProgram->get(), "model"), 1, GL_FALSE, glm::value_ptr(draw.transform));
-                for (auto & prim : _scene->meshes[draw.index]) {
-                    auto mat      = _scene->materials[prim.material].get();
-                    auto base_tex = _scene->textures[mat->base_color].get();
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, base_tex->get());
-                    glUniform1i(glGetUniformLocation(_shadowProgram->get(), "base_color"), 0);
-                    glUniform1i(glGetUniformLocation(_shadowProgram->get(), "use_base_color"), mat->base_color != 0);
-                    glUniform4fv(glGetUniformLocation(_shadowProgram->get(), "base_color_factor"), 1, glm::value_ptr(mat->base_color_factor));
-                    prim.mesh->draw();
-                }
+            if (_scene.get() != _shadowScene || _pointLightPosition != _shadowLightPosition || _pointLightIntensity != _shadowLightIntensity) {
+                _shadowScene          = _scene.get();
+                _shadowLightPosition  = _pointLightPosition;
+                _shadowLightIntensity = _pointLightIntensity;
+                _shadowDirty          = true;
+            }
+            auto & timings = frame_timings();
+            if (_shadowDirty) {
+                _shadowDirty = false;
+                auto scope   = timings.scope("RSM");
+                MICROPROFILE_SCOPEI("RSM", "ShadowPass", 0xc44536);
+                MICROPROFILE_SCOPEGPUI("ShadowPass", 0xc44536);
+                // RenderScene
+                glViewport(0, 0, _shadowSize, _shadowSize);
+                _state.bind_framebuffer(_shadowFbo->get());
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                _state.use_program(_shadowProgram->get());
+                ShadowData shadow {};
+                std::copy(shadowTransforms.begin(), shadowTransforms.end(), shadow.shadowMatrices);
+                shadow.lightPos   = _pointLightPosition;
+                shadow.farPlane   = far;
+                shadow.lightColor = _pointLightIntensity;
+                shadow.faceMask   = _shadowFaceMask;
+                bindConstants("Shadow", 1, shadow);
+                drawScene(0, 1);
             }
 
             // 2. then render scene as normal with shadow mapping (using depth cubemap)
-            glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            glClearColor(0.0, 0.0, 0.0, 1.0);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            // ConfigureShaderAndMatrices
-            auto viewTransform       = _camera.getViewMatrix();
-            auto projectionTransform = _camera.getProjectionMatrix(getAspect());
-            // RenderScene
-            glUseProgram(_program->get());
-
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, _depthMap->get());
-            glUniform1i(glGetUniformLocation(_program->get(), "depthMap"), 0);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, _fluxMap->get());
-            glUniform1i(glGetUniformLocation(_program->get(), "fluxMap"), 1);
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, _normalMap->get());
-            glUniform1i(glGetUniformLocation(_program->get(), "normalMap"), 2);
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, _randomMap->get());
-            glUniform1i(glGetUniformLocation(_program->get(), "randomMap"), 3);
-
-            glUniformMatrix4fv(glGetUniformLocation(_program->get(), "projection"), 1, false, glm::value_ptr(projectionTransform));
-            glUniformMatrix4fv(glGetUniformLocation(_program->get(), "view"), 1, false, glm::value_ptr(viewTransform));
-            glUniform3fv(glGetUniformLocation(_program->get(), "lightPos"), 1, glm::value_ptr(_pointLightPosition));
-            glUniform3fv(glGetUniformLocation(_program->get(), "lightColor"), 1, glm::value_ptr(_pointLightIntensity));
-            glUniform3fv(glGetUniformLocation(_program->get(), "viewPos"), 1, glm::value_ptr(_camera.getPosition()));
-            glUniform1f(glGetUniformLocation(_program->get(), "far_plane"), far);
-
-            glUniform1f(glGetUniformLocation(_program->get(), "sampleRange"), _sampleRange);
-            glUniform1i(glGetUniformLocation(_program->get(), "sampleNum"), _sampleNum);
-            glUniform1i(glGetUniformLocation(_program->get(), "disableDirectLight"), _disableDirectLight);
-            glUniform1i(glGetUniformLocation(_program->get(), "disableIndirectLight"), _disableIndirectLight);
-            glUniform1f(glGetUniformLocation(_program->get(), "indirectLightPower"), _indirectLightPower);
-            glUniform1f(glGetUniformLocation(_program->get(), "directLightPower"), _directLightPower);
-
-            for (auto & draw : _scene->draws) {
-                glUniformMatrix4fv(glGetUniformLocation(_program->get(), "model"), 1, GL_FALSE, glm::value_ptr(draw.transform));
-                for (auto & prim : _scene->meshes[draw.index]) {
-                    auto mat      = _scene->materials[prim.material].get();
-                    auto base_tex = _scene->textures[mat->base_color].get();
-                    glActiveTexture(GL_TEXTURE4);
-                    glBindTexture(GL_TEXTURE_2D, base_tex->get());
-                    glUniform1i(glGetUniformLocation(_program->get(), "base_color"), 4);
-                    glUniform1i(glGetUniformLocation(_program->get(), "use_base_color"), mat->base_color != 0);
-                    glUniform4fv(glGetUniformLocation(_program->get(), "base_color_factor"), 1, glm::value_ptr(mat->base_color_factor));
-                    prim.mesh->draw();
+            {
+                auto scope = timings.scope("Camera");
+                MICROPROFILE_SCOPEI("RSM", "CameraPass", 0x197278);
+                MICROPROFILE_SCOPEGPUI("CameraPass", 0x197278);
+                if (_sceneTargetsDirty) createSceneTargets();
+                auto size = renderSize();
+                glViewport(0, 0, size.x, size.y);
+                _state.bind_framebuffer(splitLighting() ? _lightingFbo->get() : _sceneFbo->get());
+                glClearColor(0.0, 0.0, 0.0, 1.0);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                // ConfigureShaderAndMatrices
+                auto viewTransform       = _camera.getViewMatrix();
+                auto projectionTransform = _camera.getProjectionMatrix(getAspect());
+                // RenderScene
+                _state.use_program(_activeProgram->get());
+
+                _state.bind_texture(0, GL_TEXTURE_CUBE_MAP, _depthMap->get());
+                _state.set_uniform("depthMap", 0);
+                _state.bind_texture(1, GL_TEXTURE_CUBE_MAP, _fluxMap->get());
+                _state.set_uniform("fluxMap", 1);
+                _state.bind_texture(2, GL_TEXTURE_CUBE_MAP, _normalMap->get());
+                _state.set_uniform("normalMap", 2);
+                _samples->require(_samplePattern, sampleSetSize());
+                _state.bind_texture(3, GL_TEXTURE_BUFFER, _samples->texture());
+                _state.set_uniform("samplePattern", 3);
+
+                FrameData frame {};
+                frame.projection           = projectionTransform;
+                frame.view                 = viewTransform;
+                frame.lightPos             = _pointLightPosition;
+                frame.farPlane             = far;
+                frame.lightColor           = _pointLightIntensity;
+                frame.sampleRange          = _sampleRange;
+                frame.viewPos              = _camera.getPosition();
+                frame.sampleNum            = _sampleNum;
+                frame.sampleOffset         = _scrambleSamples ? sample_frame_offset(frame_timings().current_frame()) : glm::vec2(0.0f);
+                frame.interleave           = splitLighting() ? _interleave : 1;
+                frame.indirectLightPower   = _indirectLightPower;
+                frame.directLightPower     = _directLightPower;
+                frame.disableDirectLight   = _disableDirectLight;
+                frame.disableIndirectLight = _disableIndirectLight;
+                frame.splitLighting        = splitLighting();
+                bindConstants("Frame", 1, frame);
+                drawScene(4, 5, true);
+            }
+
+            // 2b. the depth of this frame culls the frames a few readbacks later
+            if (_occlusionCulling) {
+                auto scope = timings.scope("HiZ");
+                MICROPROFILE_SCOPEI("RSM", "HiZ", 0x5e6472);
+                MICROPROFILE_SCOPEGPUI("HiZ", 0x5e6472);
+                buildDepthPyramid(_camera.getProjectionMatrix(getAspect()) * _camera.getViewMatrix());
+            }
+
+            // 3. gather interleaved samples, filter the indirect light and
+            // combine it with the direct light
+            if (splitLighting()) {
+                auto scope = timings.scope("Denoise");
+                MICROPROFILE_SCOPEI("RSM", "Denoise", 0x8d99ae);
+                MICROPROFILE_SCOPEGPUI("Denoise", 0x8d99ae);
+                auto viewport = glm::vec2(renderSize());
+                auto source   = _indirectLight.get();
+                int  target   = 0;
+                if (_interleave > 1) {
+                    _state.bind_framebuffer(_filteredFbo[target]->get());
+                    _gather->uniforms = [&](RenderState & state) {
+                        state.bind_texture(1, GL_TEXTURE_2D, _normalDepth->get());
+                        state.set_uniform("normalDepth", 1);
+                        state.set_uniform("viewport", viewport);
+                        state.set_uniform("blockSize", _interleave);
+                        state.set_uniform("depthSigma", _denoiseDepthSigma);
+                        state.set_uniform("normalPower", _denoiseNormalPower);
+                    };
+                    _renderer->blit(_state, source, _gather.get());
+                    source = _filtered[target].get();
+                    target = 1 - target;
+                }
+                for (int i = 0; _denoise && i < _denoiseIterations; i++) {
+                    _state.bind_framebuffer(_filteredFbo[target]->get());
+                    _atrous->uniforms = [&](RenderState & state) {
+                        state.bind_texture(1, GL_TEXTURE_2D, _normalDepth->get());
+                        state.set_uniform("normalDepth", 1);
+                        state.set_uniform("viewport", viewport);
+                        state.set_uniform("stepSize", _denoiseRadius << i);
+                        state.set_uniform("depthSigma", _denoiseDepthSigma);
+                        state.set_uniform("normalPower", _denoiseNormalPower);
+                    };
+                    _renderer->blit(_state, source, _atrous.get());
+                    source = _filtered[target].get();
+                    target = 1 - target;
+                }
+                _state.bind_framebuffer(_sceneFbo->get());
+                _composite->uniforms = [&](RenderState & state) {
+                    state.bind_texture(1, GL_TEXTURE_2D, source->get());
+                    state.set_uniform("indirectLight", 1);
+                    state.bind_texture(2, GL_TEXTURE_2D, _albedo->get());
+                    state.set_uniform("albedo", 2);
+                    state.set_uniform("indirectLightPower", _indirectLightPower);
+                };
+                _renderer->blit(_state, _directLight.get(), _composite.get());
+            }
+
+            // 4. upscale to the window
+            {
+                auto scope = timings.scope("Upscale");
+                MICROPROFILE_SCOPEI("RSM", "Upscale", 0x6a4c93);
+                MICROPROFILE_SCOPEGPUI("Upscale", 0x6a4c93);
+                glViewport(0, 0, getWidth(), getHeight());
+                _state.bind_framebuffer(0);
+                _upscale->uniforms = [&](RenderState & state) {
+                    state.set_uniform("viewport", glm::vec2(renderSize()));
+                    state.set_uniform("sharpness", _sharpness);
+                };
+                _renderer->blit(_state, _sceneColor.get(), _upscale.get());
+            }
+            _frameConstants->end_frame();
+        }
+
+        // Writes a constant block into this frame's region of the ring and
+        // binds it for the current program
+        template<typename T>
+        void bindConstants(const char * block, GLuint binding, const T & data) {
+            auto allocation = _frameConstants->allocate(sizeof(T));
+            std::memcpy(allocation.data, &data, sizeof(T));
+            _frameConstants->flush();
+            _state.set_uniform_block(block, binding);
+            _state.bind_uniform_buffer_range(binding, allocation.buffer, allocation.offset, allocation.size);
+        }
+
+        // Binds each base color page once and draws all instances of a mesh
+        // that sample it with one call, materials are looked up per vertex.
+        // `culled` draws only the instances listed by updateCulling(), their
+        // indices are bound to the unit after `instanceUnit` and the
+        // materials to the one after that.
+        void drawScene(GLuint pageUnit, GLuint instanceUnit, bool culled = false) {
+            _state.set_uniform("baseColorPage", (int) pageUnit);
+            _state.bind_texture(instanceUnit + 2, GL_TEXTURE_BUFFER, _scene->material_texture->get());
+            _state.set_uniform("materials", (int) instanceUnit + 2);
+            _scene->flush_transforms();
+            _state.bind_texture(instanceUnit, GL_TEXTURE_BUFFER, _scene->instance_texture->get());
+            _state.set_uniform("instances", (int) instanceUnit);
+            _state.set_uniform("culled", culled);
+            if (culled) {
+                _state.bind_texture(instanceUnit + 1, GL_TEXTURE_BUFFER, _visibleTexture->get());
+                _state.set_uniform("visibleInstances", (int) instanceUnit + 1);
+            }
+            for (auto [groupIndex, batchIndex] : _scene->draw_order) {
+                auto & group = _scene->instance_groups[groupIndex];
+                auto & batch = _scene->batches[group.mesh][batchIndex];
+                auto [first, count] = culled ? _visibleGroups[groupIndex] : std::make_pair(group.first_instance, group.instance_count);
+                if (count == 0) continue;
+                if (batch.page >= 0) {
+                    _state.bind_texture(pageUnit, GL_TEXTURE_2D_ARRAY, _scene->pages[batch.page]->get());
                 }
+                _state.set_uniform("firstInstance", (int) first);
+                _scene->geometry->draw_instanced(_state, batch.first_index, batch.index_count, count);
             }
         }
     };
 }; // namespace rsm
 
-int main() {
+int main(int argc, char ** argv) {
     try {
-        rsm::RSMApp app {};
+        rsm::RSMApp app { LaunchOptions::parse(argc, argv) };
         app.run();
     } catch (std::exception & e) {
         std::cerr << e.what() << std::endl;